@@ -1,13 +1,18 @@
 #pragma once
 
+#include "inline_string.hpp"
+#include "rate_limiter.hpp"
 #include "utilities.hpp"
 #include <atomic>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 class Client;
@@ -27,39 +32,100 @@ typedef std::weak_ptr<Server> WeakServer;
 // If channel is secret, chatters can only join by being invited by a moderator.
 // An invitation token is created by a moderator to send to a chatter.
 // The invited chatter should send the token with the enter request.
+// Invitations expire after the server's `invitationTtl`.
+struct Invitation {
+  int client;
+  uint64_t expires;
+};
+
 class Channel {
 public:
   const int id;
   std::mutex mtx;
-  std::string name;
+  ChannelName name;
   WeakClient emperor;
-  const size_t MAXCAPACITY{50};
+  const size_t MAXCAPACITY;
+  const size_t CHUNKSIZE;
+  const size_t HISTORY;
 
   WeakServer server;
-  std::atomic_int packetIds{1};
   std::atomic_bool secret{false};
+  TokenBucket ingress;
 
   std::string pinnedMessage;
-  std::vector<int> invitations{};
-  std::vector<WeakClient> members{};
+  std::vector<Invitation> invitations{};
   std::vector<WeakClient> moderators{};
 
+  // Members are published as immutable snapshots. Readers (fan-out, roster,
+  // command lookups) load the current one without locking; writers hold `mtx`,
+  // copy it with their change and swap the copy in. A replaced snapshot is
+  // freed when its last reader, e.g. a batch still being delivered, drops it.
+  typedef std::vector<WeakClient> Members;
+  std::atomic<std::shared_ptr<const Members>> members{
+      std::make_shared<const Members>()};
+  // Sequence number of the first frame stamped after each member joined, by
+  // client id, so a resume never replays what was said before. Guarded by
+  // `mtx` like the membership.
+  std::unordered_map<int, uint32_t> joinedAt{};
+
+  // Broadcast frames carry the channel's sequence number as their id, stamped
+  // in queue order. The last HISTORY frames fanned out are kept, oldest
+  // first, to replay to resuming clients; `dispatched` is the sequence number
+  // of the next frame to be fanned out. All guarded by `queueMutex`.
+  // Sequence numbers start at 1 and skip 0 when they wrap, so a resuming
+  // client that saw no frame of the channel reports NONE_SEEN.
+  static constexpr uint32_t NONE_SEEN{0};
   std::mutex queueMutex;
   std::condition_variable cv;
   std::queue<Response> messageQueue{};
+  std::atomic_uint32_t sequence{1};
+  uint32_t dispatched{1};
+  std::deque<Response> history{};
   std::thread messageQueueWorkerThread;
   std::atomic_bool stopBroadcast{false};
 
-  void broadcast(Response packet);
-  bool send_message(const WeakClient &actor, std::string message);
+  // Completion of the batch being fanned out. Shared with its chunk tasks,
+  // which may finish after the channel is gone.
+  struct FanOut {
+    std::mutex mtx;
+    std::condition_variable cv;
+    bool busy{false};
+    bool stop{false};
+  };
+  std::shared_ptr<FanOut> fanOut{std::make_shared<FanOut>()};
+
+  // Membership changes since the last presence flush, latest per client.
+  std::mutex presenceMutex;
+  std::unordered_map<int, PRESENCE> presence{};
+  bool presenceArmed{false};
+
+  bool broadcast(Response packet, bool sheddable = false);
+  void dispatch(std::vector<Response> packets);
+  bool pump();
+  void resume(const std::shared_ptr<Client> &client, uint32_t lastSeen,
+              int requestId);
+  bool idle();
+  bool send_message(const WeakClient &actor, std::string message,
+                    uint64_t trace = 0);
 
   bool enter_channel(WeakClient actor);             // *
   bool disconnect_member(const WeakClient &target); // *
 
+  // Membership writers, `mtx` must be held.
+  void add_member(WeakClient member);
+  void remove_member(const WeakClient &target);
+  void replace_members(Members members);
+  // History writer, `queueMutex` must be held.
+  void remember(const std::vector<Response> &batch);
+
   // utils
   std::vector<char> info();
   void self_destroy(std::string_view reason);  // *
   bool is_authority(const WeakClient &target); // *
+  void purge_invitations();
+  void note_presence(int clientId, PRESENCE change);
+  void flush_presence();
+  Response roster(int requestId);
 
   Response create_broadcast(COMMAND command, std::string data);
   Response create_broadcast(DATAKIND type, std::vector<char> data);
@@ -1,14 +1,20 @@
 #pragma once
 
+#include "dedup_window.hpp"
+#include "inline_string.hpp"
+#include "memory_budget.hpp"
+#include "rate_limiter.hpp"
+#include "transport.hpp"
 #include "utilities.hpp"
 #include <atomic>
+#include <deque>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <ostream>
-#include <sstream>
+#include <span>
 #include <string>
-#include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 // Shared Pointer Tracker (Where a client shared_ptr can be found)
@@ -19,30 +25,92 @@
 //   -> moderator vector
 //   -> emperor
 //
+// `fd` identifies the client to the reactor and the client manager, all
+// reads and writes go through its transport (a socket unless given one).
+//
+// Outbound frames travel in one of two lanes. Bulk frames (channel fan-out,
+// replays) are written by their sender, one sender at a time under `sendMtx`.
+// Control frames (replies to the client's own requests, notices) that find
+// the stream busy are queued in `control` instead, and the sender holding it
+// writes them at its next frame boundary, ahead of the rest of its frames.
+// The queue holds up to `controlLimit` bytes (at most CONTROL_LIMIT), charged
+// to the server's OUTBOUND pool while queued; when either is full, control
+// senders wait for the stream like bulk ones.
+//
+// A failed write may leave part of a frame on the wire (the transport shuts
+// down), so the stream is marked `broken` and every later send fails.
 struct Client {
+  enum LANE { CONTROL, BULK };
+  static constexpr size_t CONTROL_LIMIT{256 * 1024};
+
   int fd;
   int id;
   std::mutex mtx;
-  std::string username;
+  std::mutex sendMtx;
+  std::mutex controlMtx;
+  std::deque<Response> control{};
+  size_t controlBytes{0};
+  size_t controlLimit{CONTROL_LIMIT};
+  MemoryBudget *memory{nullptr};
+  std::atomic_size_t controlPending{0};
+  std::atomic_bool broken{false};
+  UserName username;
   std::vector<uint32_t> channels{};
   std::atomic_bool connected{false};
 
-  Client(int fd, int id) {
-    std::ostringstream username;
-    username << "user0" << id;
-    this->username = username.str();
+  TokenBucket ingress;
+  std::atomic_bool throttled{false};
+  DedupWindow recentMessages;
+  std::atomic_uint64_t lastActivity{monotonic_ms()};
+  // Bumped to start a new liveness timer chain (see Server::check_liveness);
+  // a chain stops once it is no longer the latest.
+  std::atomic_uint32_t livenessChain{0};
+  std::unique_ptr<Transport> transport;
+
+  // Session resumption. `resumeToken` is what a new connection presents to
+  // take this client over after its connection dropped (see SVR_RESUME).
+  // While `resuming`, frames of a channel listed in `deliverFrom` are only
+  // delivered from that sequence number on: nothing while the client is
+  // away, then only what its replay didn't already cover.
+  uint64_t resumeToken{0};
+  std::atomic_bool resuming{false};
+  std::mutex resumeMtx;
+  std::unordered_map<uint32_t, uint32_t> deliverFrom{};
+
+  Client(int fd, int id, std::unique_ptr<Transport> transport = nullptr) {
+    this->username.assign("user0");
+    this->username.append(std::to_string(id));
     this->fd = fd;
     this->id = id;
+    if (transport == nullptr)
+      transport = std::make_unique<SocketTransport>(fd);
+    this->transport = std::move(transport);
   }
-
-  ~Client() { close(this->fd); }
+  ~Client();
 
   void change_connection(bool b);
   bool is_member(const int channelId);
   void join_channel(const int channelId);
-  bool send_packet(const Response packet);
+  bool send_packet(const Response packet, LANE lane = CONTROL);
+  bool send_packets(const std::vector<Response> &packets, LANE lane = CONTROL,
+                    const std::shared_ptr<const void> &owner = nullptr);
+  bool read_exact(void *buffer, size_t size);
   void leave_channel(const int channelId);
-  std::string change_username(std::string username);
+  UserName change_username(std::string_view username);
+
+  void hold_channels();
+  void deliver_from(uint32_t channelId, uint32_t sequence);
+  std::vector<Response> unseen(uint32_t channelId,
+                               const std::vector<Response> &packets);
+
+  // Stream writers, see the lanes above.
+  bool send_frames(std::span<const Response> packets, LANE lane,
+                   const std::shared_ptr<const void> &owner);
+  void bound_control(MemoryBudget *budget, size_t limit);
+  bool write_control();
+  void release_stream(std::unique_lock<std::mutex> &io);
+  void reset_stream();
+  void drop_control();
 };
 
 typedef std::shared_ptr<Client> SharedClient;
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "client.hpp"
+#include "memory_budget.hpp"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Server;
+struct serversett;
+typedef std::weak_ptr<Server> WeakServer;
+
+// Consistent hash ring mapping channel ids to node ids.
+// Every node is placed on the ring VNODES times, so a node joining or leaving
+// only moves the channels adjacent to its points.
+class HashRing {
+public:
+  void add_node(uint32_t node);
+  void remove_node(uint32_t node);
+  uint32_t owner(uint32_t channelId) const;
+  bool operator==(const HashRing &other) const { return ring == other.ring; }
+
+private:
+  static constexpr int VNODES{64};
+  std::map<uint64_t, uint32_t> ring;
+};
+
+// Cluster mode: channels are spread across nodes by consistent hashing.
+//
+// Clients connect to any node. Channel requests for a channel owned by another
+// node are forwarded to it over a persistent inter-node link; the owner holds
+// remote members as proxy clients and executes the fan-out, relaying each
+// broadcast once per remote node, which then delivers it to its own members
+// (its "mirror" of the channel).
+//
+// Client ids carry their node id in the bits above NODE_SHIFT so they are
+// unique cluster-wide and the owner knows where to relay.
+//
+// Links are plain TCP connections, one outbound per peer for sending and
+// inbound ones for receiving. Frames queued for a peer are batched and
+// flushed together by the cluster thread. A peer is part of the ring while
+// its outbound link is up; when the ring changes, channels move to their new
+// owner (MIGRATE) and members of channels whose owner died rejoin the new one.
+class Cluster {
+public:
+  static constexpr int NODE_SHIFT{20};
+  static uint32_t node_of(int clientId) { return clientId >> NODE_SHIFT; }
+
+  Cluster(const serversett &settings);
+  ~Cluster();
+
+  void start(WeakServer server);
+  bool owns(uint32_t channelId);
+  bool is_remote(const Client &client) const {
+    return node_of(client.id) != this->NODE;
+  }
+
+  // Called by the node the client is connected to.
+  void forward_join(const SharedClient &client, int requestId,
+                    uint32_t channelId, bool create);
+  void forward_leave(const SharedClient &client, uint32_t channelId);
+  void forward_message(const SharedClient &client, uint32_t channelId,
+                       const std::string &message);
+  void forward_direct(int clientId, const Response &packet);
+
+  // Called by the owning node's fan-out.
+  void relay(uint32_t node, uint32_t channelId, const Response &packet);
+
+private:
+  enum FRAME : uint32_t {
+    HELLO = 1,
+    JOIN = 2,
+    JOINED = 3,
+    LEAVE = 4,
+    MESSAGE = 5,
+    RELAY = 6,
+    MIGRATE = 7,
+    DIRECT = 8,
+  };
+
+  // Frames are queued in `outbound` under `mtx`. The batch being written,
+  // `sending` from byte `sent` on, is only touched by the cluster thread.
+  struct Peer {
+    uint32_t id;
+    std::string host;
+    int port;
+    int fd{-1};
+    std::mutex mtx;
+    std::vector<char> outbound;
+    bool overflow{false};
+    std::vector<char> sending;
+    size_t sent{0};
+    bool watching{false};
+  };
+
+  struct Inbound {
+    uint32_t node{0};
+    std::vector<char> buffer;
+  };
+
+  struct PendingJoin {
+    WeakClient client;
+    int requestId;
+    uint32_t channelId;
+  };
+
+  const uint32_t NODE;
+  int listenFd{-1};
+  int epollFd{-1};
+  int wakeFd{-1};
+  WeakServer server;
+  MemoryBudget *memory{nullptr};
+  std::thread worker;
+  std::atomic_bool stop{false};
+  std::map<uint32_t, std::unique_ptr<Peer>> peers;
+  std::unordered_map<int, Inbound> inbound;
+
+  std::mutex mtx;
+  HashRing ring;
+  std::atomic_uint32_t joinTokens{1};
+  std::unordered_map<uint32_t, PendingJoin> pending;
+  std::unordered_map<uint32_t, std::vector<WeakClient>> mirrors;
+  std::unordered_map<uint32_t, uint32_t> mirrorOwners;
+  std::unordered_map<int, SharedClient> proxies;
+
+  static std::unique_ptr<Peer> parse_peer(std::string_view entry);
+  void run();
+  void connect_peers();
+  void flush_peers();
+  bool flush_peer(Peer &peer);
+  void watch_peer(Peer &peer, bool writable);
+  void peer_down(Peer &peer);
+  void rebalance();
+  void send_frame(uint32_t node, FRAME kind, const std::vector<char> &body);
+  void read_inbound(int fd);
+  void drop_inbound(int fd);
+  void handle_frame(Inbound &link, FRAME kind, const std::vector<char> &body);
+
+  uint32_t owner_of(uint32_t channelId);
+  SharedClient proxy(int clientId);
+  void add_mirror(uint32_t channelId, uint32_t owner, const SharedClient &c);
+  void remove_mirror(uint32_t channelId, const SharedClient &client);
+  void on_join(uint32_t node, const std::vector<char> &body);
+  void on_joined(const std::vector<char> &body);
+  void on_leave(const std::vector<char> &body);
+  void on_message(const std::vector<char> &body);
+  void on_relay(const std::vector<char> &body);
+  void on_migrate(const std::vector<char> &body);
+  void on_direct(const std::vector<char> &body);
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Every server tunable. Values come from the defaults below, then from the
+// config file given with `--config <file>`, then from command line flags.
+//
+// address/port is the TCP listener. `unixPath` adds a Unix stream listener
+// for clients on the same host, in the abstract namespace when it starts with
+// `@`; empty disables it. At most `acceptBudget` connections are accepted per
+// listener and turn of the reactor so a connection storm can't starve
+// established clients.
+//
+// Memory (see memory_budget.hpp) is bounded by `memoryLimit` bytes overall,
+// zero only counts. `connectionMemoryLimit` is the most a single connection
+// may hold, which is also the largest request it may send.
+//
+// Client sockets are tuned on accept (see sockets.hpp): `tcpNoDelay`, buffer
+// sizes in bytes (zero keeps the kernel's), keepalive probing in seconds and
+// `notSentLowat` in bytes (zero keeps the system default). Frames of at least
+// `zeroCopyMin` bytes fanned out by channels are sent with MSG_ZEROCOPY, zero
+// disables it.
+//
+// `dedicatedThreads` of zero sizes the pool to the CPUs this process may run
+// on. With `pinThreads` the reactor and each worker are pinned to their own
+// CPU.
+//
+// Channels hold up to `channelCapacity` members. Broadcasts are delivered in
+// chunks of `fanoutChunk` members, each chunk a separate pool task, so large
+// channels fan out on every worker at once. Each channel keeps its last
+// `channelHistory` broadcast frames to replay to resuming clients.
+//
+// Scheduler quantum is the number of frames credited to a flow (client or
+// channel) on each deficit round-robin turn of the thread pool.
+// Scheduler weight is the number of request tasks the pool runs for each
+// fan-out chunk while both are waiting, zero to always run requests first.
+//
+// Ingress limits are in requests per second, a rate of zero disables them.
+// - client : every request a connected client sends.
+// - channel : CH_MESSAGE requests targeting one channel, from all members.
+//
+// Timeouts are in milliseconds and driven by the reactor's timing wheel, which
+// turns once every `timerTick`. A timeout of zero disables it.
+// - idleTimeout : disconnects clients that sent nothing for this long.
+// - heartbeatInterval : pings clients that have been silent for this long.
+// - handshakeTimeout : disconnects clients that never sent SVR_CONNECT.
+// - invitationTtl : how long a channel invitation stays valid.
+// - presenceInterval : how long membership changes are coalesced before a
+// channel sends them as one CH_PRESENCE delta. Zero sends each on its own.
+// - resumeGrace : how long the session of a client whose connection dropped
+// is kept for SVR_RESUME. Zero disables resumption.
+//
+// Tracing (see tracer.hpp) follows one request in every `traceSample` through
+// each stage of the server, zero disables it. Every thread keeps its last
+// `traceBuffer` spans, written to `tracePath` as Chrome trace events every
+// `traceInterval` milliseconds.
+//
+// handoffPath is the Unix socket a successor connects to in order to take the
+// running server over (see handoff.hpp). Empty disables restarts.
+// takeoverPath makes this process the successor of the server on that path.
+//
+// Cluster mode (see cluster.hpp) is enabled by a non-zero `nodeId`. The node
+// accepts inter-node links on address:clusterPort and dials every peer in
+// `peers`, a comma separated list of `<node id>@<host>:<cluster port>`.
+// The handoff doesn't carry the cluster listener or the peer links, so
+// handoffPath and takeoverPath are refused in cluster mode.
+//
+// `manualDrive` is not an option: embedders such as the simulation harness
+// set it to run the server without a listener, pool workers or channel
+// threads, calling Server::serve, ThreadPool::run_one and Channel::pump
+// themselves.
+struct serversett {
+  std::string address{"127.0.0.1"};
+  int port{3000};
+  std::string unixPath{};
+  int maxChannels{10};
+  int maxClients{200};
+  uint32_t acceptBudget{256};
+  size_t memoryLimit{256 << 20};
+  size_t connectionMemoryLimit{64 << 10};
+  bool tcpNoDelay{true};
+  int sendBuffer{0};
+  int recvBuffer{0};
+  bool keepAlive{true};
+  int keepAliveIdle{60};
+  int keepAliveInterval{10};
+  int keepAliveCount{5};
+  int notSentLowat{0};
+  size_t zeroCopyMin{0};
+  int dedicatedThreads{0};
+  bool pinThreads{false};
+  size_t schedulerQuantum{64};
+  size_t schedulerWeight{4};
+  size_t channelCapacity{50};
+  size_t fanoutChunk{1024};
+  size_t channelHistory{256};
+  uint32_t clientRate{20};
+  uint32_t clientBurst{40};
+  uint32_t channelRate{200};
+  uint32_t channelBurst{400};
+  uint32_t timerTick{100};
+  uint32_t idleTimeout{90000};
+  uint32_t heartbeatInterval{30000};
+  uint32_t handshakeTimeout{10000};
+  uint32_t invitationTtl{300000};
+  uint32_t presenceInterval{250};
+  uint32_t resumeGrace{30000};
+  uint32_t traceSample{0};
+  size_t traceBuffer{4096};
+  std::string tracePath{"rc-trace.json"};
+  uint32_t traceInterval{10000};
+  std::string handoffPath{};
+  std::string takeoverPath{};
+  uint32_t nodeId{0};
+  int clusterPort{0};
+  std::string peers{};
+  bool manualDrive{false};
+};
+
+bool load_settings(int argc, char *argv[], serversett &settings);
+void print_usage(const char *program);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Sliding window over the ids of a client's recently accepted CH_MESSAGE
+// requests, so a retry of one of them can be acknowledged again instead of
+// being broadcast a second time.
+//
+// Ids up to WINDOW behind the highest id recorded map to one bit each. Every
+// slot also keeps a fingerprint of the payload it was recorded with, so a
+// client that reuses an id for a different message isn't mistaken for a
+// retry. Ids older than the window are never duplicates.
+//
+// Only the request path touches it, and a client's requests are handled one
+// at a time, so it needs no locking.
+class DedupWindow {
+public:
+  static constexpr uint32_t WINDOW{64};
+
+  bool contains(int32_t id, uint32_t fingerprint) const;
+  void record(int32_t id, uint32_t fingerprint);
+  static uint32_t fingerprint(const std::vector<uint8_t> &payload);
+
+private:
+  bool started{false};
+  uint32_t highest{0};
+  uint64_t bits{0};
+  std::array<uint32_t, WINDOW> fingerprints{};
+};
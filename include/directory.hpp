@@ -0,0 +1,54 @@
+#pragma once
+
+#include "inline_string.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Listing of the public channels hosted on this node, served to CH_LIST.
+//
+// Readers only load the current snapshot: a list of entries sorted by name
+// and their pages, already encoded. They never lock the directory or any
+// channel. Writers (channel create/rename/privacy change/destroy) build the
+// next snapshot, re-encoding only the pages from the first changed entry on
+// and sharing the others with the previous one, then publish it with a new
+// version.
+//
+// A listing is:
+// <version> <page> <page count> <entry count> { <channel id> <name> }
+class Directory {
+public:
+  static constexpr size_t PAGE_SIZE{32};
+
+  void update(uint32_t channelId, const ChannelName &name, bool secret);
+  void remove(uint32_t channelId);
+  std::vector<char> list(uint32_t page, std::string_view prefix) const;
+
+private:
+  struct Entry {
+    ChannelName name;
+    uint32_t id;
+    auto operator<=>(const Entry &other) const = default;
+  };
+
+  typedef std::shared_ptr<const std::vector<char>> Page;
+
+  struct Snapshot {
+    uint64_t version{0};
+    std::vector<Entry> entries;
+    std::vector<Page> pages;
+  };
+
+  std::mutex mtx;
+  std::unordered_map<uint32_t, ChannelName> names;
+  std::atomic<std::shared_ptr<const Snapshot>> current{
+      std::make_shared<const Snapshot>()};
+
+  void publish(std::vector<Entry> entries, size_t changed);
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "channel.hpp"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Zero-downtime restart.
+//
+// A running server listening on a handoff path accepts one successor on that
+// Unix socket (SOCK_SEQPACKET), quiesces, and sends it:
+// 1. the serialized client and channel state, in chunks;
+// 2. the listening sockets and every client socket through SCM_RIGHTS.
+// The successor rebuilds its managers from the state, acknowledges with a
+// single byte and the old process exits without touching the connections.
+struct ClientState {
+  int fd;
+  int id;
+  bool connected;
+  std::string username;
+  std::vector<uint32_t> channels;
+};
+
+struct ChannelState {
+  int id;
+  int emperor;
+  bool secret;
+  uint32_t sequence;
+  std::string name;
+  std::string pinnedMessage;
+  std::vector<int> members;
+  std::vector<int> moderators;
+  std::vector<Invitation> invitations;
+};
+
+struct HandoffState {
+  int listenFd{-1};
+  int unixFd{-1};
+  int nextClientId{1};
+  std::vector<ClientState> clients;
+  std::vector<ChannelState> channels;
+};
+
+int handoff_listen(const std::string &path);
+int handoff_connect(const std::string &path);
+bool handoff_send(int sock, const HandoffState &state);
+std::optional<HandoffState> handoff_receive(int sock);
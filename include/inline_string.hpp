@@ -0,0 +1,70 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Fixed-capacity string stored inside its owner, for the bounded names of
+// clients and channels.
+//
+// The bytes live in the object itself: a client or channel record holds its
+// name without pointing to the heap, copying it is a fixed-size copy and
+// reading it never leaves the record's cache lines. Text that doesn't fit is
+// refused by `assign` and `append`, never truncated.
+template <size_t N> class InlineString {
+  static_assert(N > 0 && N < 256, "the length is kept in a single byte");
+
+public:
+  static constexpr size_t CAPACITY{N};
+
+  bool assign(std::string_view text) {
+    if (text.size() > N)
+      return false;
+    std::memcpy(this->chars, text.data(), text.size());
+    this->length = text.size();
+    return true;
+  }
+
+  bool append(std::string_view text) {
+    if (text.size() > N - this->length)
+      return false;
+    std::memcpy(this->chars + this->length, text.data(), text.size());
+    this->length += text.size();
+    return true;
+  }
+
+  const char *data() const { return this->chars; }
+  size_t size() const { return this->length; }
+  bool empty() const { return this->length == 0; }
+  std::string_view view() const { return {this->chars, this->length}; }
+  std::string str() const { return std::string(this->view()); }
+  operator std::string_view() const { return this->view(); }
+
+  bool operator==(const InlineString &other) const {
+    return this->view() == other.view();
+  }
+  std::strong_ordering operator<=>(const InlineString &other) const {
+    return this->view() <=> other.view();
+  }
+
+private:
+  char chars[N]{};
+  uint8_t length{0};
+};
+
+template <size_t N>
+std::ostream &operator<<(std::ostream &out, const InlineString<N> &text) {
+  return out << text.view();
+}
+
+// Usernames are at most MAX_USERNAME bytes as sent (terminator excluded),
+// stored with the terminator and their `@<id>` suffix: 12 + 1 + 1 + 10 bytes.
+static constexpr size_t MAX_USERNAME{12};
+typedef InlineString<24> UserName;
+
+// Channel names are at most 24 bytes.
+typedef InlineString<24> ChannelName;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "directory.hpp"
+#include "transport.hpp"
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
@@ -20,10 +22,17 @@ class ChannelManager {
 public:
   bool has_capacity();
   void remove_channel(uint32_t i);
+  std::vector<Channel *> all_channels();
   Channel *find_channel(uint32_t i) const;
+  std::vector<Channel *> find_channels(const std::vector<uint32_t> &ids);
+  void adopt_channel(uint32_t i, std::unique_ptr<Channel> channel);
   std::vector<char> create_channel(uint32_t i, WeakClient c, WeakServer s);
   ChannelManager(int max) : MAXCHANNELS(max) {};
 
+  // Public channels, kept in sync by the channel lifecycle and by the
+  // rename and privacy commands.
+  Directory directory;
+
 private:
   std::shared_mutex mutex;
   const size_t MAXCHANNELS;
@@ -33,14 +42,35 @@ private:
 class ClientManager {
 public:
   bool has_capacity();
-  void add_client(int fd);
+  std::shared_ptr<Client> add_client(int fd,
+                                     std::unique_ptr<Transport> transport = nullptr);
+  std::shared_ptr<Client> adopt_client(int fd, int id,
+                                       std::unique_ptr<Transport> transport = nullptr);
+  std::vector<std::shared_ptr<Client>> all_clients();
+  int next_id() const { return this->clientIds; }
   void remove_client(uint32_t id);
-  ClientManager(int max) : MAXCLIENTS(max) {};
+  // Ids are handed out from `firstId` upwards (see Cluster::NODE_SHIFT).
+  ClientManager(int max, uint32_t rate, uint32_t burst, int firstId = 1)
+      : MAXCLIENTS(max), RATE(rate), BURST(burst), clientIds(firstId) {};
   std::optional<std::shared_ptr<Client>> find_client(uint32_t i) const;
+  std::optional<std::shared_ptr<Client>> find_by_id(uint32_t id);
+
+  // Sessions of clients whose connection dropped, by resume token. A parked
+  // client keeps its id and memberships but no longer has a connection.
+  uint64_t issue_token(Client &client);
+  void park(const std::shared_ptr<Client> &client);
+  std::shared_ptr<Client> resume(uint64_t token,
+                                 const std::shared_ptr<Client> &connection);
+  std::shared_ptr<Client> expire(uint64_t token);
+  std::vector<uint64_t> parked_tokens();
 
 private:
   const size_t MAXCLIENTS;
+  const uint32_t RATE;
+  const uint32_t BURST;
   std::shared_mutex mutex;
   std::atomic_int clientIds{1};
   std::unordered_map<uint32_t, std::shared_ptr<Client>> clients;
+  std::unordered_map<uint32_t, WeakClient> ids;
+  std::unordered_map<uint64_t, std::shared_ptr<Client>> sessions;
 };
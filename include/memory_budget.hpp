@@ -0,0 +1,64 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Byte counters for the memory the server holds on behalf of its clients,
+// with a hard global ceiling.
+//
+// - REQUESTS : request frames read and being handled.
+// - MAILBOXES : frames queued in channels or being fanned out.
+// - CLUSTER : frames queued for other nodes.
+// - HISTORY : frames channels retain for session resumption.
+// - OUTBOUND : control frames queued for a client's busy stream.
+//
+// Sheddable work (requests, chat messages) is only admitted with `try_charge`
+// and dropped when it would cross the limit. Control traffic (commands,
+// presence, cluster links) is always charged so it still counts but is never
+// lost. A limit of zero only counts.
+class MemoryBudget {
+public:
+  enum POOL {
+    REQUESTS = 0,
+    MAILBOXES = 1,
+    CLUSTER = 2,
+    HISTORY = 3,
+    OUTBOUND = 4,
+  };
+
+  MemoryBudget(size_t limit) : LIMIT(limit) {};
+
+  bool try_charge(POOL pool, size_t bytes);
+  void charge(POOL pool, size_t bytes);
+  void release(POOL pool, size_t bytes);
+  size_t used() const { return this->total.load(); }
+
+  // <limit> <used> <pool count> { <name> <bytes> }
+  std::vector<char> snapshot() const;
+
+private:
+  static constexpr size_t POOLS{5};
+
+  const size_t LIMIT;
+  std::atomic_size_t total{0};
+  std::array<std::atomic_size_t, POOLS> pools{};
+};
+
+// Releases a charge when it goes out of scope.
+class MemoryCharge {
+public:
+  MemoryCharge(MemoryBudget &budget, MemoryBudget::POOL pool, size_t bytes)
+      : budget(budget), pool(pool), bytes(bytes) {};
+  ~MemoryCharge() { this->budget.release(this->pool, this->bytes); }
+
+  MemoryCharge(const MemoryCharge &) = delete;
+  MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+private:
+  MemoryBudget &budget;
+  MemoryBudget::POOL pool;
+  size_t bytes;
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+// Hands work from any thread back to the reactor.
+//
+// Posted tasks are pushed onto a lock-free stack and the reactor is woken
+// through an eventfd registered in its epoll set. Only the post that finds
+// the stack empty writes the eventfd, so a burst of posts costs the reactor
+// a single wakeup; it then runs the whole burst in posting order.
+class Notifier {
+public:
+  typedef std::function<void()> Task;
+
+  Notifier();
+  ~Notifier();
+
+  int fd() const { return this->eventFd; }
+  void post(Task task);
+  size_t drain();
+
+private:
+  struct Node {
+    Task task;
+    Node *next;
+  };
+
+  int eventFd;
+  std::atomic<Node *> head{nullptr};
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free token bucket used to bound ingress per client and per channel.
+//
+// The whole state lives in one 64-bit word so a take is a single CAS loop:
+// - high 32 bits : timestamp (ms, wrapping) of the last refill.
+// - low 32 bits  : available tokens scaled by SCALE.
+//
+// A bucket with a rate of zero is disabled and always grants.
+class TokenBucket {
+public:
+  TokenBucket() = default;
+  TokenBucket(uint32_t rate, uint32_t burst) { this->configure(rate, burst); }
+
+  // Must be called before the bucket is shared between threads.
+  void configure(uint32_t rate, uint32_t burst);
+  bool try_take(uint32_t tokens = 1);
+
+private:
+  static constexpr uint64_t SCALE{1000};
+
+  uint32_t rate{0};
+  uint64_t capacity{0};
+  std::atomic_uint64_t state{0};
+};
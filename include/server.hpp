@@ -2,91 +2,242 @@
 
 #include "channel.hpp"
 #include "client.hpp"
+#include "cluster.hpp"
+#include "config.hpp"
+#include "handoff.hpp"
 #include "managers.hpp"
+#include "memory_budget.hpp"
+#include "notifier.hpp"
+#include "sockets.hpp"
+#include "text.hpp"
 #include "thread_pool.hpp"
+#include "timer_wheel.hpp"
+#include "topology.hpp"
+#include "tracer.hpp"
 #include <arpa/inet.h>
 #include <cstdlib>
+#include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <netinet/in.h>
-#include <shared_mutex>
+#include <optional>
 #include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
-struct serversett {
-  int port{3000};
-  int maxChannels{15};
-  int maxClients{1000};
-  int dedicatedThreads{10};
-};
-
 class Server : public std::enable_shared_from_this<Server> {
 private:
   int epollFd;
+  int timerFd;
   int serverFd;
-  std::shared_mutex epollMtx;
+  int unixFd{-1};
+  int handoffFd{-1};
+  // Client watchers are rearmed by the reactor itself, workers post the
+  // rearm through it.
+  std::unique_ptr<Notifier> notifier;
+
+  void handoff();
+  void accept_clients(int listener);
+  std::unique_ptr<Transport> open_transport(int fd);
+
+  void on_timer_tick();
+  void watch_client(std::shared_ptr<Client> client);
+  void check_liveness(const WeakClient &client, uint32_t chain);
+  void notify_later(const std::shared_ptr<Client> &client, Response packet,
+                    bool drop);
+  void flush_trace();
 
   int read_size(WeakClient pointer); // *
-  int read_incoming(std::shared_ptr<Client> client);
+  int read_incoming(std::shared_ptr<Client> client, uint64_t trace);
+  bool admit(const std::shared_ptr<Client> &client, Request &request);
 
   // Server Related Request Handlers
   // SVR_CONNECT handler is builtin the read_incoming
   // SRV_MESSAGE is exclusive to server -> client so it doesn't have a handler.
-  void srv_disconnect(const WeakClient &client);
+  void srv_disconnect(const WeakClient &client, bool resumable = false);
+  Response svr_resume(const std::shared_ptr<Client> &connection,
+                      Request &request);
+  void leave_channels(const std::shared_ptr<Client> &client);
+  void expire_session(uint64_t token);
 
   // Channel Related Request Handlers
   Response ch_connect(WeakClient &client, Request &request);
   Response ch_command(const WeakClient &client, Request &request);
   Response ch_message(const WeakClient &client, Request &request);
   Response ch_disconnect(const WeakClient &client, Request &request);
+  Response ch_list(Request &request);
+  Response ch_bulk_connect(WeakClient &client, Request &request);
+  Response ch_bulk_disconnect(const WeakClient &client, Request &request);
+  Response ch_bulk_message(const WeakClient &client, Request &request);
+  OUTCOME leave(const SharedClient &client, uint32_t channelId,
+                Channel *channel);
+  OUTCOME post(const SharedClient &client, uint32_t channelId,
+               Channel *channel, const std::string &message,
+               uint64_t trace = 0);
+
+  // Client Related Request Handlers
+  Response cl_message(const WeakClient &client, Request &request);
 
 public:
+  const serversett settings;
   std::unique_ptr<ThreadPool> threadPool;
   std::unique_ptr<ClientManager> clients;
   std::unique_ptr<ChannelManager> channels;
+  std::unique_ptr<TimerWheel> timers;
+  std::unique_ptr<Cluster> cluster;
+  std::unique_ptr<MemoryBudget> memory;
+  std::unique_ptr<Tracer> tracer;
 
-  Server(serversett settings) {
-    this->serverFd = socket(AF_INET, SOCK_STREAM, 0);
-    this->clients = std::make_unique<ClientManager>(settings.maxClients);
+  // Listening sockets inherited from a handoff can be given in `listenFd` and
+  // `unixListenFd`, otherwise new ones are bound on the configured port and
+  // Unix path.
+  Server(serversett settings, int listenFd = -1, int unixListenFd = -1)
+      : settings(settings) {
+    this->serverFd = listenFd;
+    this->memory = std::make_unique<MemoryBudget>(settings.memoryLimit);
+    this->tracer =
+        std::make_unique<Tracer>(settings.traceSample, settings.traceBuffer);
+    this->clients = std::make_unique<ClientManager>(
+        settings.maxClients, settings.clientRate, settings.clientBurst,
+        (settings.nodeId << Cluster::NODE_SHIFT) | 1);
+    if (settings.nodeId != 0)
+      this->cluster = std::make_unique<Cluster>(settings);
     this->channels = std::make_unique<ChannelManager>(settings.maxChannels);
-    this->threadPool = std::make_unique<ThreadPool>(settings.dedicatedThreads);
+    // With pinning the reactor takes the first CPU and workers the next ones.
+    const bool pin = settings.pinThreads;
+    const std::vector<int> cpus = available_cpus();
+    Tracer *tracer = this->tracer.get();
+    this->threadPool = std::make_unique<ThreadPool>(
+        settings.manualDrive ? 0 : settings.dedicatedThreads,
+        settings.schedulerQuantum, settings.schedulerWeight,
+        [pin, cpus, tracer](int worker) {
+          if (pin)
+            pin_current_thread(cpus[(worker + 1) % cpus.size()]);
+          tracer->name_thread("worker " + std::to_string(worker));
+        });
+    this->timers = std::make_unique<TimerWheel>(settings.timerTick);
+
+    if (this->serverFd == -1 && !settings.manualDrive) {
+      this->serverFd =
+          socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (this->serverFd == -1) {
+        std::cerr << "could not create server socket" << std::endl;
+        exit(1);
+      }
 
-    if (this->serverFd == -1) {
-      std::cerr << "could not create server socket" << std::endl;
-      exit(1);
+      sockaddr_in addr{};
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(settings.port);
+      if (inet_pton(AF_INET, settings.address.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "invalid listen address" << std::endl;
+        close(this->serverFd);
+        exit(2);
+      }
+
+      if (bind(this->serverFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        std::cerr << "server could not be initialized on given addr"
+                  << std::endl;
+        close(this->serverFd);
+        exit(2);
+      }
+
+      if (::listen(this->serverFd, SOMAXCONN) == -1) {
+        std::cerr << "could not start listening to socket" << std::endl;
+        close(this->serverFd);
+        exit(3);
+      }
     }
 
-    sockaddr_in addr{};
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(settings.port);
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    epoll_event ev;
+    this->epollFd = epoll_create1(0);
+    if (this->serverFd != -1) {
+      // An inherited listener may come from a version that left it blocking.
+      fcntl(this->serverFd, F_SETFL,
+            fcntl(this->serverFd, F_GETFL) | O_NONBLOCK);
 
-    if (bind(this->serverFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-      std::cerr << "server could not be initialized on given addr" << std::endl;
-      close(this->serverFd);
-      exit(2);
+      // Exclusive so only one waiter wakes up per connection if the listener
+      // is shared with other event loops.
+      ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+      ev.data.fd = this->serverFd;
+      epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->serverFd, &ev);
     }
 
-    if (::listen(this->serverFd, SOMAXCONN) == -1) {
-      std::cerr << "could not start listening to socket" << std::endl;
-      close(this->serverFd);
-      exit(3);
+    // The Unix listener is served by the same loop and handlers. One
+    // inherited from a predecessor is only kept if still configured.
+    if (settings.unixPath.empty() || settings.manualDrive) {
+      if (unixListenFd != -1)
+        close(unixListenFd);
+    } else {
+      this->unixFd =
+          unixListenFd != -1 ? unixListenFd : listen_unix(settings.unixPath);
+      if (this->unixFd == -1) {
+        std::cerr << "could not listen on `" << settings.unixPath << "`"
+                  << std::endl;
+        exit(2);
+      }
+      fcntl(this->unixFd, F_SETFL, fcntl(this->unixFd, F_GETFL) | O_NONBLOCK);
+      ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+      ev.data.fd = this->unixFd;
+      epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->unixFd, &ev);
     }
 
-    epoll_event ev;
+    this->notifier = std::make_unique<Notifier>();
     ev.events = EPOLLIN;
-    ev.data.fd = this->serverFd;
-    this->epollFd = epoll_create1(0);
-    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->serverFd, &ev);
-    std::cout << "[DEBUG] Server ready to listen..." << std::endl;
+    ev.data.fd = this->notifier->fd();
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->notifier->fd(), &ev);
+
+    this->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (this->timerFd == -1) {
+      std::cerr << "could not create timer" << std::endl;
+      exit(4);
+    }
+
+    const long tick = this->timers->tick_ms();
+    itimerspec interval{};
+    interval.it_interval.tv_sec = tick / 1000;
+    interval.it_interval.tv_nsec = (tick % 1000) * 1000000;
+    interval.it_value = interval.it_interval;
+    timerfd_settime(this->timerFd, 0, &interval, nullptr);
+
+    ev.events = EPOLLIN;
+    ev.data.fd = this->timerFd;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->timerFd, &ev);
+
+    if (!settings.handoffPath.empty()) {
+      this->handoffFd = handoff_listen(settings.handoffPath);
+      if (this->handoffFd == -1) {
+        std::cerr << "could not open handoff socket" << std::endl;
+        exit(5);
+      }
+      ev.events = EPOLLIN;
+      ev.data.fd = this->handoffFd;
+      epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->handoffFd, &ev);
+    }
+    std::cout << "[DEBUG] Server ready to listen (text scanner: "
+              << text_scanner() << ")..." << std::endl;
   }
 
   ~Server() {
+    if (this->handoffFd != -1)
+      close(this->handoffFd);
+    close(this->timerFd);
     close(this->epollFd);
-    close(this->serverFd);
+    if (this->serverFd != -1)
+      close(this->serverFd);
+    if (this->unixFd != -1)
+      close(this->unixFd);
   }
 
   void listen();
+  bool serve(const std::shared_ptr<Client> &client, uint64_t trace = 0);
+  std::shared_ptr<Client> attach(int fd,
+                                 std::unique_ptr<Transport> transport = nullptr);
   void destroy_channel(int id);
+  void restore(const HandoffState &state);
+  std::optional<std::vector<char>> enter(const WeakClient &client,
+                                         uint32_t channelId, bool create);
+  std::optional<std::vector<char>> enter(const WeakClient &client,
+                                         uint32_t channelId, bool create,
+                                         Channel *channel);
 };
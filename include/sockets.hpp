@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+struct serversett;
+
+// Binds a non-blocking Unix stream listener on `path`, in the abstract
+// namespace when it starts with `@`. -1 on failure.
+int listen_unix(const std::string &path);
+
+// Applies the configured TCP options to an accepted client socket.
+// - TCP_NODELAY : frames leave as soon as they are written; batches that
+// should share segments are corked by the sender (see Client::send_packets).
+// - SO_SNDBUF / SO_RCVBUF : zero keeps the kernel's autotuning.
+// - SO_KEEPALIVE with TCP_KEEPIDLE / TCP_KEEPINTVL / TCP_KEEPCNT.
+// - TCP_NOTSENT_LOWAT : bounds unsent data queued in the kernel, zero keeps
+// the system default.
+void tune_socket(int fd, const serversett &settings);
+
+// Lets sends on the socket use MSG_ZEROCOPY (SO_ZEROCOPY), false when the
+// kernel or the socket family doesn't support it.
+bool enable_zerocopy(int fd);
+
+// Holds back partial segments while several frames are written (TCP_CORK).
+void cork_socket(int fd, bool on);
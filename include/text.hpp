@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Checks for the text clients send (messages, usernames) on the ingress path.
+//
+// Text is UTF-8 that ends at its first null byte, or at the end of the
+// payload when it has none. It is scanned once for both its terminator and
+// its validity, 32 bytes at a time with AVX2 or 16 with SSE2, whichever the
+// CPU supports (picked at startup), and 8 bytes at a time elsewhere. Only the
+// bytes of multi-byte characters are decoded one by one, so checking a
+// message costs about as much as copying it.
+static constexpr size_t MAX_MESSAGE{1000};
+
+std::optional<std::string_view> scan_text(const void *data, size_t size,
+                                          size_t limit);
+std::string_view text_scanner();
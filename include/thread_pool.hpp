@@ -1,32 +1,74 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <mutex>
-#include <queue>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
+
+// Task pool scheduling with deficit round-robin across flows.
+//
+// Every task belongs to a flow (a client, a channel or the shared default
+// flow) and carries a cost in frames. Each flow has its own run queue and
+// active flows are visited in turn, every visit crediting QUANTUM frames to
+// the flow's deficit. A flow runs tasks while its deficit covers them, so a
+// channel with thousands of queued broadcasts gets the same share of workers
+// as a client waiting on a single CH_CONNECT.
+//
+// Flows are split in two priority classes: requests (client flows and the
+// default flow) and fan-out (channel flows). Each class has its own active
+// list, and while both have work a fan-out task runs after every WEIGHT
+// request tasks, so a user's request never waits behind the whole backlog of
+// the busy channels it sits in. A weight of zero runs requests strictly
+// first.
+//
+// A pool of size zero has no workers: tasks only run through `run_one`.
 class ThreadPool {
 public:
-  ThreadPool(int size) {
+  static constexpr uint64_t DEFAULT_FLOW{0};
+  static constexpr uint64_t client_flow(uint32_t id) {
+    return (uint64_t{1} << 32) | id;
+  }
+  static constexpr uint64_t channel_flow(uint32_t id) {
+    return (uint64_t{2} << 32) | id;
+  }
+  enum PRIORITY { REQUESTS, FANOUT };
+  static constexpr PRIORITY priority_of(uint64_t flow) {
+    return flow >> 32 == 2 ? FANOUT : REQUESTS;
+  }
+
+  // A quantum of zero would never let a flow run, it is taken as one.
+  // `init` runs first on every worker with its index, before the worker
+  // allocates anything, so thread placement (pinning) can happen there.
+  ThreadPool(int size, size_t quantum = 64, size_t weight = 4,
+             std::function<void(int)> init = nullptr)
+      : QUANTUM(std::max<size_t>(quantum, 1)), WEIGHT(weight) {
     for (int t = 0; t < size; t++) {
-      this->threads.emplace_back([this]() {
+      this->threads.emplace_back([this, init, t]() {
+        if (init)
+          init(t);
         while (true) {
           std::function<void()> task;
           {
             std::unique_lock lock(this->mtx);
-            this->cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+            this->cv.wait(lock, [this]() { return stop || this->queued(); });
 
-            if (this->stop && this->tasks.empty())
+            if (this->stop && !this->queued())
               return;
 
-            task = std::move(this->tasks.front());
-            this->tasks.pop();
+            task = this->next();
+            this->running.fetch_add(1);
           }
 
           task();
+          this->running.fetch_sub(1);
         }
       });
     }
@@ -40,18 +82,104 @@ public:
     this->cv.notify_all();
   }
 
+  // True while tasks are queued or running.
+  bool busy() {
+    std::unique_lock lock(this->mtx);
+    return this->queued() || this->running > 0;
+  }
+
+  // * Runs the next task on the calling thread, false when none is queued.
+  // - Lets a pool of size zero be driven by hand, one task at a time.
+  bool run_one() {
+    std::function<void()> task;
+    {
+      std::unique_lock lock(this->mtx);
+      if (!this->queued())
+        return false;
+      task = this->next();
+      this->running.fetch_add(1);
+    }
+    task();
+    this->running.fetch_sub(1);
+    return true;
+  }
+
   template <typename F> inline void enqueue(F &&f) {
+    this->enqueue(DEFAULT_FLOW, 1, std::forward<F>(f));
+  }
+
+  template <typename F>
+  inline void enqueue(uint64_t flow, size_t cost, F &&f) {
     {
       std::unique_lock lock(this->mtx);
-      this->tasks.emplace(std::forward<F>(f));
+      Flow &queue = this->flows[flow];
+      if (queue.tasks.empty()) {
+        queue.deficit = this->QUANTUM;
+        this->active[priority_of(flow)].push_back(flow);
+      }
+      queue.tasks.push_back({cost, std::forward<F>(f)});
     }
     this->cv.notify_one();
   }
 
 private:
+  struct Task {
+    size_t cost;
+    std::function<void()> run;
+  };
+
+  struct Flow {
+    size_t deficit{0};
+    std::deque<Task> tasks;
+  };
+
+  const size_t QUANTUM;
+  const size_t WEIGHT;
   std::mutex mtx;
   std::condition_variable cv;
   std::atomic_bool stop{false};
+  std::atomic_size_t running{0};
   std::vector<std::thread> threads;
-  std::queue<std::function<void()>> tasks;
+  std::deque<uint64_t> active[2];
+  std::unordered_map<uint64_t, Flow> flows;
+  // Request tasks run in a row while fan-out was waiting.
+  size_t streak{0};
+
+  bool queued() const {
+    return !this->active[REQUESTS].empty() || !this->active[FANOUT].empty();
+  }
+
+  // * Picks the next task to run. Must be called with `mtx` held.
+  // - Requests go first, unless fan-out has waited WEIGHT request tasks.
+  // - The flow at the head of the class's active list runs while its deficit
+  // covers the cost of its next task.
+  // - Otherwise it is credited one quantum and moved to the back of the list.
+  // - Drained flows are forgotten, so idle clients and channels cost nothing.
+  std::function<void()> next() {
+    const bool fanout =
+        this->active[REQUESTS].empty() ||
+        (!this->active[FANOUT].empty() && this->WEIGHT != 0 &&
+         this->streak >= this->WEIGHT);
+    this->streak = fanout || this->active[FANOUT].empty() ? 0 : this->streak + 1;
+    std::deque<uint64_t> &active = this->active[fanout ? FANOUT : REQUESTS];
+    while (true) {
+      const uint64_t key = active.front();
+      Flow &flow = this->flows[key];
+      Task &head = flow.tasks.front();
+      if (head.cost <= flow.deficit) {
+        flow.deficit -= head.cost;
+        std::function<void()> task = std::move(head.run);
+        flow.tasks.pop_front();
+        if (flow.tasks.empty()) {
+          this->flows.erase(key);
+          active.pop_front();
+        }
+        return task;
+      }
+
+      flow.deficit += this->QUANTUM;
+      active.pop_front();
+      active.push_back(key);
+    }
+  }
 };
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Hierarchical hashed timing wheel.
+//
+// Four levels of 64 slots, each level covering 64 times the range of the one
+// below. A timer is hashed into the lowest level whose range covers its
+// deadline and cascades down as the wheel turns, so scheduling, cancelling and
+// firing are all O(1) no matter how many connections hold timers.
+//
+// The wheel owns no clock: the reactor calls `advance` with the number of
+// ticks that elapsed (read from its timerfd).
+class TimerWheel {
+public:
+  typedef uint64_t TimerId;
+  typedef std::function<void()> Callback;
+
+  TimerWheel(uint32_t tickMs) : TICK_MS(tickMs == 0 ? 1 : tickMs) {};
+
+  TimerId schedule(uint64_t delayMs, Callback callback);
+  bool cancel(TimerId id);
+  void advance(uint64_t ticks);
+  uint32_t tick_ms() const { return this->TICK_MS; }
+
+private:
+  static constexpr size_t LEVELS{4};
+  static constexpr size_t SLOT_BITS{6};
+  static constexpr size_t SLOTS{1 << SLOT_BITS};
+
+  struct Timer {
+    TimerId id;
+    uint64_t deadline;
+    Callback callback;
+  };
+
+  struct Location {
+    size_t level;
+    size_t slot;
+    std::list<Timer>::iterator it;
+  };
+
+  typedef std::array<std::list<Timer>, SLOTS> Level;
+
+  const uint32_t TICK_MS;
+  std::mutex mtx;
+  uint64_t current{0};
+  TimerId timerIds{1};
+  std::array<Level, LEVELS> levels;
+  std::unordered_map<TimerId, Location> locations;
+
+  void place(Timer timer);
+  void cascade(size_t level);
+};
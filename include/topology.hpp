@@ -0,0 +1,11 @@
+#pragma once
+
+#include <vector>
+
+// CPUs this process is allowed to run on, in ascending order.
+std::vector<int> available_cpus();
+
+// Pins the calling thread to one CPU. Memory the thread touches first after
+// this is allocated on that CPU's NUMA node by the kernel's first-touch
+// policy, so per-thread structures should be created after pinning.
+bool pin_current_thread(int cpu);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sampled request tracing, exported as Chrome trace events.
+//
+// One request in every SAMPLE gets a trace id when the reactor picks it up.
+// Each stage it goes through records a span into a ring owned by the thread
+// that ran it, so recording never contends with other threads. Rings keep
+// the last CAPACITY spans and overwrite older ones. Requests that aren't
+// sampled cost one counter increment.
+//
+// Stages, in request order:
+// - reactor : epoll_wait returning to the request being queued.
+// - pool wait : queued in the thread pool.
+// - read : reading the request off the connection.
+// - handler : running the request handler.
+// - channel queue : a broadcast waiting in the channel's queue.
+// - fan-out wait : a fan-out chunk queued in the thread pool.
+// - fan-out : delivering a chunk to its members.
+// - send : the response write, or the slowest member write of a chunk.
+//
+// `flush` writes every ring to a JSON file chrome://tracing and Perfetto can
+// load. Spans carry their trace id and the spans of one trace are linked by
+// flow arrows across threads.
+class Tracer {
+public:
+  const uint32_t SAMPLE;
+  const size_t CAPACITY;
+
+  // A SAMPLE of zero disables tracing.
+  Tracer(uint32_t sample, size_t capacity);
+
+  bool enabled() const { return this->SAMPLE != 0; }
+  uint64_t sample();
+  void record(uint64_t trace, const char *stage, uint64_t start,
+              uint64_t end = now());
+  void name_thread(std::string name);
+  bool flush(const std::string &path);
+
+  // Microseconds on the steady clock.
+  static uint64_t now();
+
+private:
+  struct Span {
+    uint64_t trace;
+    const char *stage;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  struct Ring {
+    std::thread::id owner;
+    uint32_t tid;
+    std::string name;
+    std::mutex mtx;
+    std::vector<Span> spans;
+    uint64_t written{0};
+  };
+
+  const uint64_t ID;
+  std::atomic_uint64_t requests{0};
+  std::mutex mtx;
+  std::vector<std::unique_ptr<Ring>> rings;
+
+  Ring &ring();
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Byte stream a Client reads its requests from and writes its frames to.
+//
+// The server only talks to clients through this interface, so the socket
+// layer can be swapped for an in-memory one that runs the real handlers
+// without the kernel (see MemoryTransport and test/simulation.cpp).
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  // Reads exactly `size` bytes, false on hang-up, error or timeout.
+  virtual bool read_exact(void *buffer, size_t size) = 0;
+  // Writes all of `size` bytes, false on error or timeout. A stream that
+  // failed a write may hold part of a frame and must not be written again.
+  virtual bool write_all(const char *data, size_t size) = 0;
+  // Same, for bytes `owner` keeps alive and unchanged as long as the
+  // transport holds on to it, so they may be sent without being copied.
+  virtual bool write_shared(const char *data, size_t size,
+                            [[maybe_unused]] const std::shared_ptr<const void>
+                                &owner) {
+    return this->write_all(data, size);
+  }
+  // Collects what the kernel reported on the stream's error queue (zero-copy
+  // completions), false when there was nothing.
+  virtual bool collect_errors() { return false; }
+  // Holds back partial segments while a burst of frames is written.
+  virtual void cork(bool on) = 0;
+  // Ends the stream: pending and future reads fail, which is how the server
+  // drops a client from outside its request path.
+  virtual void shutdown() = 0;
+};
+
+// Non-blocking socket. Reads and writes wait for readiness up to
+// IO_TIMEOUT_MS when the socket is not ready, so a request or a frame can't
+// be cut in half, and a stalled peer can't hold a worker forever. A write
+// that fails anyway shuts the socket down.
+//
+// With a non-zero `zeroCopyMin` (the socket must have SO_ZEROCOPY) shared
+// frames of at least that many bytes are sent with MSG_ZEROCOPY. The kernel
+// then reads them from their buffer while transmitting, so their owner is
+// held until the completion for the send is read from the socket's error
+// queue. Completions are collected while a write waits for the socket to
+// drain (wait_ready), and by the reactor on a wakeup that only reports the
+// error queue. Writes that never wait don't collect them, so owners are
+// held until the reactor sees the completions. Once the kernel reports it
+// had to copy anyway (e.g. loopback), the socket goes back to plain sends.
+class SocketTransport : public Transport {
+public:
+  static constexpr int IO_TIMEOUT_MS{5000};
+
+  SocketTransport(int fd, size_t zeroCopyMin = 0)
+      : fd(fd), zeroCopyMin(zeroCopyMin) {};
+  ~SocketTransport() override;
+
+  bool read_exact(void *buffer, size_t size) override;
+  bool write_all(const char *data, size_t size) override;
+  bool write_shared(const char *data, size_t size,
+                    const std::shared_ptr<const void> &owner) override;
+  bool collect_errors() override;
+  void cork(bool on) override;
+  void shutdown() override;
+
+private:
+  const int fd;
+  // Zero-copy sends not completed yet, by send number.
+  std::mutex zeroCopyMtx;
+  size_t zeroCopyMin;
+  uint32_t zeroCopySends{0};
+  std::deque<std::pair<uint32_t, std::shared_ptr<const void>>> inFlight;
+
+  bool wait_ready(short events);
+  bool abort_stream();
+};
+
+// In-memory stream for the simulation harness.
+// - Reads consume the bytes handed over with `deliver` and never wait: they
+// fail once the stream runs dry, so requests must be delivered whole.
+// - Writes are not stored, only counted and folded into an FNV-1a hash so
+// two runs can be compared byte for byte.
+class MemoryTransport : public Transport {
+public:
+  void deliver(const std::vector<char> &data);
+  size_t readable();
+  bool closed();
+  uint64_t written() const { return this->bytesWritten; }
+  uint64_t digest() const { return this->hash; }
+
+  bool read_exact(void *buffer, size_t size) override;
+  bool write_all(const char *data, size_t size) override;
+  void cork(bool) override {}
+  void shutdown() override;
+
+private:
+  std::mutex mtx;
+  std::deque<char> inbound;
+  bool hungUp{false};
+  uint64_t bytesWritten{0};
+  uint64_t hash{14695981039346656037ull};
+};
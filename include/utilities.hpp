@@ -1,14 +1,85 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <string>
 #include <string_view>
 #include <vector>
 
 class Channel;
 
+uint64_t monotonic_ms();
+void set_clock(uint64_t (*clock)());
 int i32_from_le(const std::vector<uint8_t> bytes);
 std::vector<std::vector<uint8_t>> split_newline(std::vector<uint8_t> &data);
+// Little-endian writers used by the internal wire formats (handoff, cluster).
+void put_u32(std::vector<char> &out, uint32_t value);
+void put_u64(std::vector<char> &out, uint64_t value);
+void put_string(std::vector<char> &out, std::string_view value);
+
+template <typename T>
+void put_ints(std::vector<char> &out, const std::vector<T> &values) {
+  put_u32(out, values.size());
+  for (auto value : values)
+    put_u32(out, value);
+}
+
+// Bounds-checked reader over the internal wire formats, `ok` turns false on
+// overrun and every later read returns zeroes.
+struct ByteReader {
+  const std::vector<char> &data;
+  size_t offset{0};
+  bool ok{true};
+
+  bool take(void *dst, size_t n) {
+    if (!ok || this->offset + n > this->data.size())
+      return ok = false;
+    std::memcpy(dst, this->data.data() + this->offset, n);
+    this->offset += n;
+    return true;
+  }
+
+  uint8_t u8() {
+    uint8_t value = 0;
+    this->take(&value, 1);
+    return value;
+  }
+
+  uint32_t u32() {
+    uint32_t value = 0;
+    this->take(&value, 4);
+    return value;
+  }
+
+  uint64_t u64() {
+    uint64_t value = 0;
+    this->take(&value, 8);
+    return value;
+  }
+
+  std::string string() {
+    std::string value(std::min<size_t>(this->u32(), this->data.size()), '\0');
+    this->take(value.data(), value.size());
+    return value;
+  }
+
+  // Everything left, consumed.
+  std::vector<char> rest() {
+    std::vector<char> value(this->data.begin() + this->offset, this->data.end());
+    this->offset = this->data.size();
+    return value;
+  }
+
+  template <typename T> std::vector<T> ints() {
+    std::vector<T> values(std::min<size_t>(this->u32(), this->data.size()));
+    for (auto &value : values)
+      value = static_cast<T>(this->u32());
+    return values;
+  }
+};
+
 enum DATAKIND {
   SVR_CONNECT = 1,
   SVR_DISCONNECT = 2,
@@ -17,6 +88,14 @@ enum DATAKIND {
   CH_DISCONNECT = 5,
   CH_MESSAGE = 6,
   CH_COMMAND = 7,
+  CH_LIST = 8,
+  CH_PRESENCE = 9,
+  CL_MESSAGE = 10,
+  SVR_MEMORY = 11,
+  SVR_RESUME = 12,
+  CH_BULK_CONNECT = 13,
+  CH_BULK_DISCONNECT = 14,
+  CH_BULK_MESSAGE = 15,
 };
 
 enum COMMAND {
@@ -24,11 +103,41 @@ enum COMMAND {
   PIN = 7,
 };
 
+// Kind byte that prefixes every SVR_MESSAGE payload.
+enum NOTICE {
+  INFO = 0,
+  ERROR = 1,
+  ANNOUNCEMENT = 2,
+  HEARTBEAT = 3,
+};
+
+// Membership change carried by CH_PRESENCE, also used as a member's role in
+// roster snapshots (JOINED for plain members).
+enum PRESENCE {
+  JOINED = 1,
+  LEFT = 2,
+  MODERATOR = 3,
+  EMPEROR = 4,
+};
+
+// Result for one channel of a bulk request.
+enum OUTCOME {
+  FAILED = 0,
+  DONE = 1,
+  FORWARDED = 2, // the owning node answers with a CH_CONNECT response
+  BUSY = 3,
+  THROTTLED = 4,
+};
+
 struct Response {
   int id{-1};
   int size{-1};
   int type{-1};
   std::vector<char> data{};
+  // Trace id of the sampled request that caused a broadcast and when it was
+  // queued (see tracer.hpp).
+  uint64_t trace{0};
+  uint64_t queuedAt{0};
 };
 
 Response c_response(const int32_t id, const uint32_t type);
@@ -38,11 +147,13 @@ Response c_response(const int32_t id, const uint32_t type,
                     const std::string_view data);
 Response c_response(const int32_t id, const uint32_t type,
                     const std::vector<char> data);
+Response c_notice(const NOTICE kind, const std::string_view message);
 
 struct Request {
   int id;
   int type;
   std::vector<uint8_t> payload;
+  uint64_t trace{0};
 
   Request(std::vector<uint8_t> &data) {
     this->id = i32_from_le({data[0], data[1], data[2], data[3]});
@@ -71,6 +182,30 @@ struct Request {
     case 7:
       typeString = "CH_COMMAND";
       break;
+    case 8:
+      typeString = "CH_LIST";
+      break;
+    case 9:
+      typeString = "CH_PRESENCE";
+      break;
+    case 10:
+      typeString = "CL_MESSAGE";
+      break;
+    case 11:
+      typeString = "SVR_MEMORY";
+      break;
+    case 12:
+      typeString = "SVR_RESUME";
+      break;
+    case 13:
+      typeString = "CH_BULK_CONNECT";
+      break;
+    case 14:
+      typeString = "CH_BULK_DISCONNECT";
+      break;
+    case 15:
+      typeString = "CH_BULK_MESSAGE";
+      break;
     default:
       typeString = "INVALID";
       break;
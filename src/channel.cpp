@@ -1,10 +1,13 @@
 #include "channel.hpp"
+#include "cluster.hpp"
 #include "server.hpp"
+#include "tracer.hpp"
 #include "utilities.hpp"
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <optional>
+#include <set>
 #include <sstream>
 #include <string>
 #include <sys/types.h>
@@ -14,17 +17,28 @@
 // - Check if the MAXCAPACITY has been reached.
 // - If the channel is secret, check if the client was invited.
 bool Channel::enter_channel(WeakClient actor) {
+  std::unique_lock lock(this->mtx);
   if (this->secret) {
-    if (std::erase_if(this->invitations, [&](int &invitation) {
-          return invitation == actor.lock()->id;
-        }) == 0)
+    const int id = actor.lock()->id;
+    const uint64_t now = monotonic_ms();
+    bool invited = false;
+    std::erase_if(this->invitations, [&](const Invitation &invitation) {
+      if (invitation.client == id) {
+        invited = invited || invitation.expires > now;
+        return true;
+      }
+      return invitation.expires <= now;
+    });
+    if (!invited)
       return false;
   }
 
-  if (this->members.size() == this->MAXCAPACITY)
+  if (this->members.load()->size() >= this->MAXCAPACITY)
     return false;
 
-  this->members.push_back(actor);
+  this->add_member(actor);
+  lock.unlock();
+  this->note_presence(actor.lock()->id, PRESENCE::JOINED);
   return true;
 }
 
@@ -40,102 +54,235 @@ bool Channel::disconnect_member(const WeakClient &target) {
       auto newEmperor = this->moderators[0];
       this->moderators.erase(this->moderators.begin());
       this->emperor = newEmperor;
+      this->remove_member(target);
 
-      std::erase_if(this->members, [&](const WeakClient &member) {
-        return member.lock() == target.lock();
-      });
-
+      this->note_presence(target.lock()->id, PRESENCE::LEFT);
+      if (auto promoted = newEmperor.lock())
+        this->note_presence(promoted->id, PRESENCE::EMPEROR);
       return false;
     }
   }
 
-  std::erase_if(this->members, [&](const WeakClient &member) {
-    return member.lock() == target.lock();
-  });
-
+  this->remove_member(target);
   std::erase_if(this->moderators, [&](const WeakClient &mod) {
     return mod.lock() == target.lock();
   });
 
   auto sclient = target.lock();
   sclient->leave_channel(this->id);
+  this->note_presence(sclient->id, PRESENCE::LEFT);
 
   return false;
 }
 
+void Channel::add_member(WeakClient member) {
+  if (auto client = member.lock())
+    this->joinedAt[client->id] = this->sequence;
+  auto next = std::make_shared<Members>(*this->members.load());
+  next->push_back(std::move(member));
+  this->members.store(std::move(next));
+}
+
+// An expired `target` drops every expired member.
+void Channel::remove_member(const WeakClient &target) {
+  auto client = target.lock();
+  if (client != nullptr)
+    this->joinedAt.erase(client->id);
+  auto next = std::make_shared<Members>(*this->members.load());
+  std::erase_if(*next, [&](const WeakClient &member) {
+    return member.lock() == client;
+  });
+  this->members.store(std::move(next));
+}
+
+// Members restored from elsewhere (a handoff or a migration) count as joined
+// now: the frames before are not in this channel's history.
+void Channel::replace_members(Members members) {
+  this->joinedAt.clear();
+  for (const WeakClient &member : members) {
+    if (auto client = member.lock())
+      this->joinedAt[client->id] = this->sequence;
+  }
+  this->members.store(std::make_shared<const Members>(std::move(members)));
+}
+
+// Channel limits come from the server settings, or their defaults when the
+// server is already gone.
+static size_t setting(const WeakServer &server, size_t serversett::*field) {
+  if (auto s = server.lock())
+    return s->settings.*field;
+  return serversett{}.*field;
+}
+
 Channel::Channel(int id, WeakClient creator, WeakServer server)
-    : id(id), emperor(creator), server(server) {
-  std::ostringstream oss;
-  oss << '#' << "channel" << id;
-  this->name = oss.str();
-  this->members.push_back(creator);
+    : id(id), emperor(creator),
+      MAXCAPACITY(setting(server, &serversett::channelCapacity)),
+      CHUNKSIZE(setting(server, &serversett::fanoutChunk)),
+      HISTORY(setting(server, &serversett::channelHistory)), server(server) {
+  this->name.assign("#channel");
+  this->name.append(std::to_string(id));
+  this->replace_members({creator});
+  if (auto s = server.lock()) {
+    this->ingress.configure(s->settings.channelRate, s->settings.channelBurst);
+  }
   std::cout << "[DEBUG] channel `" << this->name << "` created" << std::endl;
+  // A manually driven server pumps its channels itself.
+  if (auto s = server.lock(); s != nullptr && s->settings.manualDrive)
+    return;
+
+  // One batch is in flight at a time: the next one is only taken off the
+  // queue once every chunk of the previous one has been delivered.
   this->messageQueueWorkerThread = std::thread([this]() {
-    while (!this->stopBroadcast) {
-      std::unique_lock lock(this->queueMutex);
-      this->cv.wait(lock, [this]() {
-        return this->stopBroadcast || !this->messageQueue.empty();
-      });
-      if (this->stopBroadcast)
-        return;
-
-      if (!this->server.expired()) {
-        this->server.lock()->threadPool->enqueue([this]() {
-          std::vector<Response> messages_to_send;
-          {
-            std::unique_lock lock(this->queueMutex);
-            while (!this->messageQueue.empty()) {
-              messages_to_send.push_back(this->messageQueue.front());
-              this->messageQueue.pop();
-            }
-          }
-          for (const auto &packet : messages_to_send) {
-            for (auto member : this->members) {
-              if (auto client = member.lock()) {
-                client->send_packet(packet);
-              }
-            }
-          }
+    if (auto server = this->server.lock())
+      server->tracer->name_thread(this->name.str());
+    auto fanOut = this->fanOut;
+    while (true) {
+      {
+        std::unique_lock lock(fanOut->mtx);
+        fanOut->cv.wait(lock, [&]() { return !fanOut->busy || fanOut->stop; });
+        if (fanOut->stop)
+          return;
+      }
+      {
+        std::unique_lock lock(this->queueMutex);
+        this->cv.wait(lock, [this]() {
+          return this->stopBroadcast || !this->messageQueue.empty();
         });
+        if (this->stopBroadcast)
+          return;
       }
+      this->pump();
     }
   });
 }
 
+// * Takes everything queued as the next batch and fans it out.
+// - Does nothing while the previous batch is still being delivered.
+// - Returns whether a batch was dispatched.
+bool Channel::pump() {
+  std::vector<Response> batch;
+  {
+    std::unique_lock lock(this->queueMutex);
+    std::unique_lock gate(this->fanOut->mtx);
+    if (this->fanOut->busy || this->messageQueue.empty())
+      return false;
+    while (!this->messageQueue.empty()) {
+      batch.push_back(std::move(this->messageQueue.front()));
+      this->messageQueue.pop();
+    }
+    this->fanOut->busy = true;
+    this->dispatched = static_cast<uint32_t>(batch.back().id) + 1;
+    if (this->dispatched == NONE_SEEN)
+      this->dispatched = 1;
+    this->remember(batch);
+  }
+  this->dispatch(std::move(batch));
+  return true;
+}
+
+// * Appends a batch to the history, dropping the oldest frames past HISTORY.
+// Must be called with `queueMutex` held.
+void Channel::remember(const std::vector<Response> &batch) {
+  if (this->HISTORY == 0)
+    return;
+  auto server = this->server.lock();
+  for (size_t i = batch.size() > this->HISTORY ? batch.size() - this->HISTORY
+                                               : 0;
+       i < batch.size(); i++) {
+    this->history.push_back(batch[i]);
+    if (server != nullptr)
+      server->memory->charge(MemoryBudget::HISTORY, batch[i].data.size());
+  }
+  for (; this->history.size() > this->HISTORY; this->history.pop_front()) {
+    if (server != nullptr)
+      server->memory->release(MemoryBudget::HISTORY,
+                              this->history.front().data.size());
+  }
+}
+
+// * Replays what a resumed client missed, then lets live frames through.
+// - Frames fanned out after `lastSeen` are sent again from the history, all
+// of them for NONE_SEEN, but never frames from before the client joined.
+// When the history doesn't reach back that far, the roster goes first so
+// the client can resync membership; it sees the gap in the sequence numbers.
+// - Holding the queue keeps new batches from starting meanwhile. A batch
+// already in flight skips the client, its frames are part of the replay.
+void Channel::resume(const std::shared_ptr<Client> &client, uint32_t lastSeen,
+                     int requestId) {
+  Response roster = this->roster(requestId);
+  uint32_t from = lastSeen;
+  {
+    std::unique_lock lock(this->mtx);
+    auto joined = this->joinedAt.find(client->id);
+    if (joined != this->joinedAt.end())
+      from = std::max(from, joined->second - 1);
+  }
+  std::unique_lock lock(this->queueMutex);
+  const uint32_t oldest = this->history.empty()
+                              ? this->dispatched
+                              : static_cast<uint32_t>(this->history.front().id);
+  std::vector<Response> frames;
+  if (oldest - 1 > from)
+    frames.push_back(std::move(roster));
+  for (const auto &frame : this->history) {
+    if (static_cast<uint32_t>(frame.id) > from)
+      frames.push_back(frame);
+  }
+  if (!frames.empty())
+    client->send_packets(frames, Client::BULK);
+  client->deliver_from(this->id, this->dispatched);
+}
+
 Channel::~Channel() {
   std::ostringstream data;
   auto server = this->server.lock();
   data << this->name << "destroyed";
   auto packet = c_response(0, DATAKIND::CH_COMMAND, data.str());
 
-  for (WeakClient pointer : this->members) {
+  for (WeakClient pointer : *this->members.load()) {
     if (!pointer.expired()) {
       auto client = pointer.lock();
       client->leave_channel(this->id);
-      if (client->connected) {
-        server->threadPool->enqueue(
-            [packet, client]() { client->send_packet(packet); });
+      if (client->connected && server != nullptr) {
+        server->threadPool->enqueue([packet, client]() {
+          client->send_packet(packet, Client::BULK);
+        });
       }
     }
   }
 
   this->stopBroadcast.exchange(true);
   this->cv.notify_all();
+  {
+    std::unique_lock lock(this->fanOut->mtx);
+    this->fanOut->stop = true;
+  }
+  this->fanOut->cv.notify_all();
 
   if (this->messageQueueWorkerThread.joinable()) {
     this->messageQueueWorkerThread.join();
   }
 
+  // Frames never fanned out and the history give their memory back.
+  for (; server != nullptr && !this->messageQueue.empty();
+       this->messageQueue.pop()) {
+    server->memory->release(MemoryBudget::MAILBOXES,
+                            this->messageQueue.front().data.size());
+  }
+  for (const auto &frame : this->history) {
+    if (server != nullptr)
+      server->memory->release(MemoryBudget::HISTORY, frame.data.size());
+  }
+
   std::cout << "[DEBUG] " << this->name << " channel destroyed" << std::endl;
 }
 
 std::vector<char> Channel::info() {
   uint32_t id = this->id;
-  std::string name = this->name;
+  const ChannelName name = this->name;
   uint8_t secret = this->secret ? 1 : 0;
 
-  std::vector<char> information;
-  information.reserve(5 + name.size());
+  std::vector<char> information(5 + name.size());
 
   std::memcpy(information.data(), &id, sizeof(id));
   std::memcpy(information.data() + 4, &secret, 1);
@@ -144,18 +291,169 @@ std::vector<char> Channel::info() {
   return information;
 }
 
-void Channel::broadcast(Response packet) {
-  auto server = this->server.lock();
-  server->threadPool->enqueue([&, this, packet]() {
-    for (auto member : this->members) {
-      if (auto client = member.lock()) {
-        client->send_packet(packet);
+// * Queues a packet behind the messages already waiting, so commands and
+// messages reach every member in the order they were created.
+// - Queued frames are charged to the server's memory budget until delivered.
+// A sheddable packet (a chat message) that doesn't fit is dropped.
+bool Channel::broadcast(Response packet, bool sheddable) {
+  if (auto server = this->server.lock()) {
+    const size_t bytes = packet.data.size();
+    if (!sheddable) {
+      server->memory->charge(MemoryBudget::MAILBOXES, bytes);
+    } else if (!server->memory->try_charge(MemoryBudget::MAILBOXES, bytes)) {
+      return false;
+    }
+  }
+  if (packet.trace != 0)
+    packet.queuedAt = Tracer::now();
+  std::unique_lock lock(this->queueMutex);
+  uint32_t number = this->sequence.fetch_add(1);
+  if (number == NONE_SEEN)
+    number = this->sequence.fetch_add(1);
+  packet.id = static_cast<int>(number);
+  std::memcpy(packet.data.data() + 4, &packet.id, sizeof(packet.id));
+  this->messageQueue.push(std::move(packet));
+  this->cv.notify_one();
+  return true;
+}
+
+// True when nothing is queued or being fanned out.
+bool Channel::idle() {
+  std::unique_lock lock(this->queueMutex);
+  std::unique_lock gate(this->fanOut->mtx);
+  return this->messageQueue.empty() && !this->fanOut->busy;
+}
+
+// A batch of packets being delivered to a snapshot of the members.
+struct Batch {
+  uint32_t channelId;
+  WeakServer server;
+  std::shared_ptr<Channel::FanOut> fanOut;
+  std::vector<Response> packets;
+  std::shared_ptr<const Channel::Members> members;
+  size_t bytes{0};
+  std::atomic_size_t pending;
+  std::mutex mtx;
+  std::set<uint32_t> nodes;
+  // Traces of the sampled requests among the packets.
+  std::vector<uint64_t> traces;
+};
+
+// * Sends a batch to the members in [begin, end).
+// - In cluster mode, members connected to other nodes are proxies: their
+// nodes are collected and, once the last chunk is done, each packet is relayed
+// once per remote node instead of once per member.
+// - The last chunk to finish releases the channel's next batch.
+// - A batch carrying sampled requests traces the chunk and its slowest write.
+static void deliver(const std::shared_ptr<Batch> &batch, size_t begin,
+                    size_t end, uint64_t queued) {
+  auto server = batch->server.lock();
+  Cluster *cluster = server != nullptr ? server->cluster.get() : nullptr;
+  const bool traced = server != nullptr && !batch->traces.empty();
+  const uint64_t start = traced ? Tracer::now() : 0;
+  uint64_t slowest = 0, slowestAt = start;
+  std::set<uint32_t> nodes;
+  for (size_t i = begin; i < end; i++) {
+    if (auto client = (*batch->members)[i].lock()) {
+      if (cluster != nullptr && cluster->is_remote(*client)) {
+        nodes.insert(Cluster::node_of(client->id));
+        continue;
+      }
+      const uint64_t sending = traced ? Tracer::now() : 0;
+      if (!client->resuming) {
+        client->send_packets(batch->packets, Client::BULK, batch);
+      } else {
+        auto unseen = client->unseen(batch->channelId, batch->packets);
+        if (!unseen.empty())
+          client->send_packets(unseen, Client::BULK);
+      }
+      if (traced) {
+        const uint64_t elapsed = Tracer::now() - sending;
+        if (elapsed >= slowest) {
+          slowest = elapsed;
+          slowestAt = sending;
+        }
       }
     }
-  });
+  }
+  if (traced) {
+    const uint64_t done = Tracer::now();
+    for (uint64_t trace : batch->traces) {
+      server->tracer->record(trace, "fan-out wait", queued, start);
+      server->tracer->record(trace, "fan-out", start, done);
+      server->tracer->record(trace, "send", slowestAt, slowestAt + slowest);
+    }
+  }
+
+  if (!nodes.empty()) {
+    std::unique_lock lock(batch->mtx);
+    batch->nodes.merge(nodes);
+  }
+  if (batch->pending.fetch_sub(1) != 1)
+    return;
+
+  for (uint32_t node : batch->nodes) {
+    for (const auto &packet : batch->packets) {
+      cluster->relay(node, batch->channelId, packet);
+    }
+  }
+  if (server != nullptr)
+    server->memory->release(MemoryBudget::MAILBOXES, batch->bytes);
+  {
+    std::unique_lock lock(batch->fanOut->mtx);
+    batch->fanOut->busy = false;
+  }
+  batch->fanOut->cv.notify_all();
+}
+
+// * Fans a batch of packets out to every member.
+// - Members are split into ranges of CHUNKSIZE, each delivered by its own
+// pool task so large channels use every worker.
+// - Chunks are costed by their size on the channel's flow, so a hot channel
+// is charged for every send.
+void Channel::dispatch(std::vector<Response> packets) {
+  auto server = this->server.lock();
+  auto batch = std::make_shared<Batch>();
+  batch->channelId = this->id;
+  batch->server = this->server;
+  batch->fanOut = this->fanOut;
+  batch->packets = std::move(packets);
+  for (const auto &packet : batch->packets)
+    batch->bytes += packet.data.size();
+  batch->members = this->members.load();
+
+  if (server == nullptr) {
+    batch->pending = 1;
+    deliver(batch, 0, 0, 0);
+    return;
+  }
+
+  uint64_t queued = 0;
+  for (const auto &packet : batch->packets) {
+    if (packet.trace == 0)
+      continue;
+    queued = Tracer::now();
+    server->tracer->record(packet.trace, "channel queue", packet.queuedAt,
+                           queued);
+    batch->traces.push_back(packet.trace);
+  }
+
+  const size_t count = batch->members->size();
+  const size_t chunks = std::max<size_t>((count + CHUNKSIZE - 1) / CHUNKSIZE, 1);
+  batch->pending = chunks;
+  auto flow = ThreadPool::channel_flow(this->id);
+  for (size_t chunk = 0; chunk < chunks; chunk++) {
+    const size_t begin = chunk * CHUNKSIZE;
+    const size_t end = std::min(begin + CHUNKSIZE, count);
+    auto cost = std::max<size_t>(end - begin, 1);
+    server->threadPool->enqueue(flow, cost, [batch, begin, end, queued]() {
+      deliver(batch, begin, end, queued);
+    });
+  }
 }
 
-bool Channel::send_message(const WeakClient &wclient, std::string message) {
+bool Channel::send_message(const WeakClient &wclient, std::string message,
+                           uint64_t trace) {
   std::vector<char> payload;
   auto client = wclient.lock();
   uint32_t channelId = this->id;
@@ -164,22 +462,19 @@ bool Channel::send_message(const WeakClient &wclient, std::string message) {
 
   std::memcpy(payload.data(), &channelId, sizeof(channelId));
   std::memcpy(payload.data() + 4, &clientId, sizeof(clientId));
-  std::memcpy(payload.data() + 8, &message, message.size());
+  std::memcpy(payload.data() + 8, message.data(), message.size());
 
   Response packet = this->create_broadcast(DATAKIND::CH_MESSAGE, payload);
-  std::unique_lock lock(this->queueMutex);
-  this->messageQueue.push(packet);
-  this->cv.notify_one();
-  return true;
+  packet.trace = trace;
+  return this->broadcast(std::move(packet), true);
 }
 
 // UTILITIES
 
 // Creates a response packet from a string.
+// Its id is the sequence number, stamped when it is queued.
 Response Channel::create_broadcast(DATAKIND type, std::vector<char> data) {
-  auto response = c_response(this->packetIds, type, data);
-  this->packetIds.fetch_add(1);
-  return response;
+  return c_response(0, type, data);
 }
 
 // Creates a response packet for a CH_COMMAND request.
@@ -201,6 +496,116 @@ bool Channel::is_authority(const WeakClient &actor) {
   return it != this->moderators.end();
 }
 
+// Drops every invitation past its expiry.
+void Channel::purge_invitations() {
+  const uint64_t now = monotonic_ms();
+  std::unique_lock lock(this->mtx);
+  std::erase_if(this->invitations, [&](const Invitation &invitation) {
+    return invitation.expires <= now;
+  });
+}
+
+// PRESENCE
+
+// CH_PRESENCE payload: <channel> <kind> <count> { <client> <change> }
+// - kind : 0 for a delta, 1 for a roster snapshot.
+static std::vector<char>
+presence_payload(uint32_t channelId, uint8_t kind,
+                 const std::vector<std::pair<int, PRESENCE>> &entries) {
+  std::vector<char> payload;
+  payload.reserve(9 + entries.size() * 5);
+  put_u32(payload, channelId);
+  payload.push_back(static_cast<char>(kind));
+  put_u32(payload, entries.size());
+  for (auto &[client, change] : entries) {
+    put_u32(payload, client);
+    payload.push_back(static_cast<char>(change));
+  }
+  return payload;
+}
+
+// * Records a membership change for the next presence flush.
+// - Changes are coalesced per client: only the latest is sent, and a join
+// undone by a leave before the flush is not sent at all.
+// - The first change after a flush arms the flush timer, so a burst of churn
+// costs one delta frame per interval instead of one frame per change.
+void Channel::note_presence(int clientId, PRESENCE change) {
+  auto server = this->server.lock();
+  if (server == nullptr)
+    return;
+  const uint32_t interval = server->settings.presenceInterval;
+  {
+    std::unique_lock lock(this->presenceMutex);
+    auto pending = this->presence.find(clientId);
+    if (change == PRESENCE::LEFT && pending != this->presence.end() &&
+        pending->second == PRESENCE::JOINED) {
+      this->presence.erase(pending);
+    } else {
+      this->presence[clientId] = change;
+    }
+    if (interval > 0 && this->presenceArmed)
+      return;
+    this->presenceArmed = true;
+  }
+
+  if (interval == 0) {
+    this->flush_presence();
+    return;
+  }
+  // The channel may be gone by then, so it is looked up again by id.
+  const int channelId = this->id;
+  WeakServer wserver = this->server;
+  server->timers->schedule(interval, [wserver, channelId]() {
+    if (auto server = wserver.lock()) {
+      if (auto channel = server->channels->find_channel(channelId))
+        channel->flush_presence();
+    }
+  });
+}
+
+// * Broadcasts the coalesced changes as one CH_PRESENCE delta.
+void Channel::flush_presence() {
+  std::vector<std::pair<int, PRESENCE>> changes;
+  {
+    std::unique_lock lock(this->presenceMutex);
+    changes.assign(this->presence.begin(), this->presence.end());
+    this->presence.clear();
+    this->presenceArmed = false;
+  }
+  if (changes.empty())
+    return;
+  this->broadcast(this->create_broadcast(
+      DATAKIND::CH_PRESENCE, presence_payload(this->id, 0, changes)));
+}
+
+// * Snapshot of every member and its role, sent to a client when it joins.
+Response Channel::roster(int requestId) {
+  std::vector<std::pair<int, PRESENCE>> members;
+  {
+    std::unique_lock lock(this->mtx);
+    auto emperor = this->emperor.lock();
+    auto snapshot = this->members.load();
+    members.reserve(snapshot->size());
+    for (const auto &member : *snapshot) {
+      auto client = member.lock();
+      if (client == nullptr)
+        continue;
+      PRESENCE role = PRESENCE::JOINED;
+      if (client == emperor) {
+        role = PRESENCE::EMPEROR;
+      } else if (std::any_of(this->moderators.begin(), this->moderators.end(),
+                             [&](const WeakClient &mod) {
+                               return mod.lock() == client;
+                             })) {
+        role = PRESENCE::MODERATOR;
+      }
+      members.emplace_back(client->id, role);
+    }
+  }
+  return c_response(requestId, DATAKIND::CH_PRESENCE,
+                    presence_payload(this->id, 1, members));
+}
+
 // CH_COMMAND HANDLERS
 
 // * Changes the secret status of the channel
@@ -209,6 +614,10 @@ bool Channel::change_privacy(const WeakClient &actor) {
   std::cout << "[DEBUG] " << this->name << " privacy changed" << std::endl;
   if (actor.lock() == this->emperor.lock()) {
     this->secret.exchange(!this->secret);
+    if (auto server = this->server.lock()) {
+      std::unique_lock lock(this->mtx);
+      server->channels->directory.update(this->id, this->name, this->secret);
+    }
     return true;
   }
   return false;
@@ -219,10 +628,11 @@ bool Channel::change_privacy(const WeakClient &actor) {
 // - Only the emperor can kick other moderators.
 bool Channel::kick_member(const WeakClient &actor, int target) {
   if (this->is_authority(actor)) {
+    auto members = this->members.load();
     auto targetClient = std::find_if(
-        this->members.begin(), this->members.end(),
+        members->begin(), members->end(),
         [&](const WeakClient member) { return member.lock()->id == target; });
-    if (targetClient == this->members.end())
+    if (targetClient == members->end())
       return false;
 
     if (this->is_authority(*targetClient) &&
@@ -242,12 +652,28 @@ bool Channel::invite_member(const WeakClient &actor, int target) {
   if (this->secret && !this->is_authority(actor))
     return false;
   auto server = this->server.lock();
-  auto newMember = server->clients->find_client(target);
+  auto newMember = server->clients->find_by_id(target);
   if (newMember != std::nullopt) {
-    this->invitations.push_back(target);
-    return true;
+    const uint64_t ttl = server->settings.invitationTtl;
+    const uint64_t expires = ttl > 0 ? monotonic_ms() + ttl : UINT64_MAX;
+    {
+      std::unique_lock lock(this->mtx);
+      this->invitations.push_back({target, expires});
+    }
+    if (ttl > 0) {
+      // The channel may be gone by then, so it is looked up again by id.
+      const int channelId = this->id;
+      WeakServer wserver = this->server;
+      server->timers->schedule(ttl, [wserver, channelId]() {
+        if (auto server = wserver.lock()) {
+          if (auto channel = server->channels->find_channel(channelId))
+            channel->purge_invitations();
+        }
+      });
+    }
     std::cout << "[DEBUG] " << target << " invited to " << this->name
               << std::endl;
+    return true;
   }
   return false;
 }
@@ -257,12 +683,14 @@ bool Channel::invite_member(const WeakClient &actor, int target) {
 bool Channel::promote_member(const WeakClient &actor, int target) {
   if (actor.lock() != this->emperor.lock() || this->moderators.size() == 5)
     return false;
+  auto members = this->members.load();
   auto member = std::find_if(
-      this->members.begin(), this->members.end(),
+      members->begin(), members->end(),
       [&](const WeakClient client) { return client.lock()->id == target; });
-  if (member == this->members.end())
+  if (member == members->end())
     return false;
   this->moderators.push_back(*member);
+  this->note_presence(target, PRESENCE::MODERATOR);
   std::cout << "[DEBUG] " << target << " promoted to mod in " << this->name
             << std::endl;
   return true;
@@ -277,7 +705,7 @@ bool Channel::promote_moderator(const WeakClient &actor, int target) {
   auto moderator = std::find_if(
       this->moderators.begin(), this->moderators.end(),
       [&](const WeakClient &client) { return client.lock()->id == target; });
-  if (moderator == this->members.end())
+  if (moderator == this->moderators.end())
     return false;
   auto emperor = this->emperor;
   this->emperor = *moderator;
@@ -285,6 +713,9 @@ bool Channel::promote_moderator(const WeakClient &actor, int target) {
   std::erase_if(this->moderators, [&](const WeakClient &client) {
     return client.lock()->id == target;
   });
+  this->note_presence(target, PRESENCE::EMPEROR);
+  if (auto demoted = emperor.lock())
+    this->note_presence(demoted->id, PRESENCE::MODERATOR);
 
   std::cout << "[DEBUG] " << target << " promoted to emperor in " << this->name
             << std::endl;
@@ -311,15 +742,21 @@ bool Channel::pin_message(const WeakClient &actor, std::string message) {
 
 // * Changes the channel name.
 // - Only the emperor can execute this.
-// - The new name can have between 6-24 characters.
+// - The new name can have between 6-24 characters, it ends at its first null
+// byte. Longer names are refused.
 // - The new name will be broadcasted to the whole channel.
 bool Channel::set_channel_name(const WeakClient &actor, std::string newName) {
   if (this->emperor.lock() == actor.lock()) {
+    ChannelName name;
+    if (!name.assign(newName.substr(0, newName.find('\0'))))
+      return false;
     {
       std::unique_lock lock(this->mtx);
-      this->name = newName;
+      this->name = name;
+      if (auto server = this->server.lock())
+        server->channels->directory.update(this->id, name, this->secret);
     }
-    auto packet = this->create_broadcast(COMMAND::RENAME, newName);
+    auto packet = this->create_broadcast(COMMAND::RENAME, name.str());
     this->broadcast(packet);
     std::cout << "[DEBUG] name changed in " << this->name << std::endl;
     return true;
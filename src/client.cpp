@@ -1,8 +1,8 @@
 #include "client.hpp"
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
-#include <sstream>
-#include <sys/socket.h>
 
 void Client::join_channel(const int channelId) {
   std::unique_lock lock(this->mtx);
@@ -15,14 +15,201 @@ void Client::leave_channel(const int channelId) {
                 [&](const int &channel) { return channel == channelId; });
 }
 
-bool Client::send_packet(const Response packet) {
-  auto data = packet.data;
-  if (send(this->fd, data.data(), data.size(), 0) == -1) {
+// * Sends a whole frame.
+// - Frames from concurrent senders are never interleaved.
+bool Client::send_packet(const Response packet, LANE lane) {
+  return this->send_frames({&packet, 1}, lane, nullptr);
+}
+
+// * Sends several frames back to back.
+// - The transport is corked while they are written so they leave in full
+// segments rather than one small segment per frame; single frames are sent
+// straight away.
+// - Frames `owner` keeps alive (a fan-out batch) may be sent without being
+// copied, see Transport::write_shared.
+bool Client::send_packets(const std::vector<Response> &packets, LANE lane,
+                          const std::shared_ptr<const void> &owner) {
+  return this->send_frames(packets, lane, owner);
+}
+
+// * Writes frames in their lane.
+// - Control frames that find the stream busy are queued for its writer and
+// reported as sent, unless the queue is full: they then wait for the stream.
+// - Bulk frames wait for the stream. Control frames queued meanwhile are
+// written before them and between any two of them, pushed out of the cork
+// right away, so the client's replies wait behind one bulk frame at most.
+// - False once the stream is broken.
+bool Client::send_frames(std::span<const Response> packets, LANE lane,
+                         const std::shared_ptr<const void> &owner) {
+  if (this->broken)
     return false;
+  std::unique_lock io(this->sendMtx, std::defer_lock);
+  if (lane == CONTROL && !io.try_lock()) {
+    size_t bytes = 0;
+    for (const auto &packet : packets)
+      bytes += packet.data.size();
+    std::unique_lock lock(this->controlMtx);
+    if (this->controlBytes + bytes <= this->controlLimit &&
+        (this->memory == nullptr ||
+         this->memory->try_charge(MemoryBudget::OUTBOUND, bytes))) {
+      this->control.insert(this->control.end(), packets.begin(), packets.end());
+      this->controlBytes += bytes;
+      this->controlPending.fetch_add(packets.size());
+      lock.unlock();
+      // The writer may have let go of the stream before they were queued.
+      bool sent = true;
+      if (io.try_lock()) {
+        sent = this->write_control();
+        this->release_stream(io);
+      }
+      return sent && !this->broken;
+    }
+  }
+  if (!io.owns_lock())
+    io.lock();
+
+  bool sent = this->write_control();
+  auto write = [&](const Response &packet) {
+    if (owner == nullptr)
+      return this->transport->write_all(packet.data.data(), packet.data.size());
+    return this->transport->write_shared(packet.data.data(), packet.data.size(),
+                                         owner);
+  };
+  if (sent && packets.size() == 1) {
+    sent = write(packets.front());
+  } else if (sent) {
+    this->transport->cork(true);
+    for (const auto &packet : packets) {
+      if (!(sent = write(packet)))
+        break;
+      if (lane == BULK && this->controlPending.load() != 0) {
+        if (!(sent = this->write_control()))
+          break;
+        this->transport->cork(false);
+        this->transport->cork(true);
+      }
+    }
+    this->transport->cork(false);
+  }
+  if (!sent)
+    this->broken.store(true);
+  this->release_stream(io);
+  return sent;
+}
+
+// * Writes the queued control frames, oldest first. `sendMtx` must be held.
+// - False when a write failed, the stream is then broken and the rest of the
+// queue dropped.
+bool Client::write_control() {
+  if (this->controlPending.load() == 0)
+    return !this->broken;
+  std::deque<Response> frames;
+  {
+    std::unique_lock lock(this->controlMtx);
+    frames.swap(this->control);
+    if (this->memory != nullptr)
+      this->memory->release(MemoryBudget::OUTBOUND, this->controlBytes);
+    this->controlBytes = 0;
+    this->controlPending.store(0);
+  }
+  for (const auto &packet : frames) {
+    if (this->broken ||
+        !this->transport->write_all(packet.data.data(), packet.data.size())) {
+      this->broken.store(true);
+      return false;
+    }
   }
   return true;
 }
 
+// * Lets go of the stream, taking it back for control frames queued by
+// senders that found it busy and didn't get it after.
+void Client::release_stream(std::unique_lock<std::mutex> &io) {
+  while (true) {
+    io.unlock();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (this->controlPending.load() == 0 || !io.try_lock())
+      return;
+    this->write_control();
+  }
+}
+
+// * Starts over on a new transport: the control frames queued for the old
+// one are dropped and the stream is writable again. `sendMtx` must be held.
+void Client::reset_stream() {
+  this->drop_control();
+  this->broken.store(false);
+}
+
+// * Empties the control queue, giving its bytes back to the budget.
+void Client::drop_control() {
+  std::unique_lock lock(this->controlMtx);
+  this->control.clear();
+  if (this->memory != nullptr)
+    this->memory->release(MemoryBudget::OUTBOUND, this->controlBytes);
+  this->controlBytes = 0;
+  this->controlPending.store(0);
+}
+
+Client::~Client() { this->drop_control(); }
+
+// * Charges queued control frames to `budget` and caps the queue at `limit`
+// bytes, CONTROL_LIMIT at most. Set before the client sends anything.
+void Client::bound_control(MemoryBudget *budget, size_t limit) {
+  this->memory = budget;
+  this->controlLimit = std::min(limit, CONTROL_LIMIT);
+}
+
+bool Client::read_exact(void *buffer, size_t size) {
+  return this->transport->read_exact(buffer, size);
+}
+
+// * Holds back the frames of every channel while the connection is gone.
+void Client::hold_channels() {
+  std::vector<uint32_t> joined;
+  {
+    std::unique_lock lock(this->mtx);
+    joined = this->channels;
+  }
+  std::unique_lock lock(this->resumeMtx);
+  for (uint32_t channelId : joined)
+    this->deliverFrom[channelId] = UINT32_MAX;
+  this->resuming.store(true);
+}
+
+// * Lets a channel's frames through from `sequence` on, zero for all of them.
+void Client::deliver_from(uint32_t channelId, uint32_t sequence) {
+  std::unique_lock lock(this->resumeMtx);
+  if (sequence == 0) {
+    this->deliverFrom.erase(channelId);
+  } else {
+    this->deliverFrom[channelId] = sequence;
+  }
+  this->resuming.store(!this->deliverFrom.empty());
+}
+
+// * Filters a channel's batch down to the frames this client hasn't seen.
+// - Once a whole batch passes, later ones are newer still, so the channel
+// stops being filtered.
+std::vector<Response> Client::unseen(uint32_t channelId,
+                                     const std::vector<Response> &packets) {
+  std::unique_lock lock(this->resumeMtx);
+  auto find = this->deliverFrom.find(channelId);
+  if (find == this->deliverFrom.end())
+    return packets;
+
+  std::vector<Response> out;
+  for (const auto &packet : packets) {
+    if (static_cast<uint32_t>(packet.id) >= find->second)
+      out.push_back(packet);
+  }
+  if (out.size() == packets.size()) {
+    this->deliverFrom.erase(find);
+    this->resuming.store(!this->deliverFrom.empty());
+  }
+  return out;
+}
+
 bool Client::is_member(const int channelId) {
   return std::find_if(this->channels.begin(), this->channels.end(),
                       [&](const int id) { return id == channelId; }) !=
@@ -31,10 +218,15 @@ bool Client::is_member(const int channelId) {
 
 void Client::change_connection(bool b) { this->connected.exchange(b); }
 
-std::string Client::change_username(std::string username) {
-  std::ostringstream holder;
-  holder << username << "@" << this->id;
+// * Names the client `<username>@<id>`.
+// - `username` is at most MAX_USERNAME bytes plus its terminator, so it
+// always fits with the suffix.
+UserName Client::change_username(std::string_view username) {
+  UserName name;
+  name.assign(username);
+  name.append("@");
+  name.append(std::to_string(this->id));
   std::unique_lock lock(this->mtx);
-  this->username = holder.str();
-  return holder.str();
+  this->username = name;
+  return name;
 }
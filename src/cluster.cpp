@@ -0,0 +1,864 @@
+#include "cluster.hpp"
+#include "channel.hpp"
+#include "config.hpp"
+#include "server.hpp"
+#include "utilities.hpp"
+#include <arpa/inet.h>
+#include <charconv>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// How often links to unreachable peers are retried, and how long a single
+// connection attempt may block the cluster thread.
+static constexpr uint64_t RECONNECT_MS{500};
+static constexpr int CONNECT_TIMEOUT_MS{300};
+// Frames a peer may have queued and not yet written. A peer that falls this
+// far behind is taken down like a dead one and dialed again.
+static constexpr size_t OUTBOUND_LIMIT{16 * 1024 * 1024};
+
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// HASH RING
+
+void HashRing::add_node(uint32_t node) {
+  for (uint64_t v = 0; v < VNODES; v++)
+    this->ring[mix((uint64_t{node} << 32) | v)] = node;
+}
+
+void HashRing::remove_node(uint32_t node) {
+  std::erase_if(this->ring, [&](const auto &point) {
+    return point.second == node;
+  });
+}
+
+// First node clockwise from the channel's point on the ring.
+uint32_t HashRing::owner(uint32_t channelId) const {
+  if (this->ring.empty())
+    return 0;
+  auto it = this->ring.lower_bound(mix(channelId));
+  return it == this->ring.end() ? this->ring.begin()->second : it->second;
+}
+
+// CLUSTER
+
+// * Reads one `<node id>@<host>:<cluster port>` entry of the peer list.
+// - Returns nullptr unless the id and port are whole numbers, the port is a
+// valid TCP port and the host is not empty.
+std::unique_ptr<Cluster::Peer> Cluster::parse_peer(std::string_view entry) {
+  size_t at = entry.find('@');
+  size_t colon = entry.rfind(':');
+  if (at == std::string_view::npos || colon == std::string_view::npos ||
+      colon <= at + 1)
+    return nullptr;
+
+  auto peer = std::make_unique<Peer>();
+  std::string_view id = entry.substr(0, at);
+  std::string_view port = entry.substr(colon + 1);
+  auto [idEnd, idError] =
+      std::from_chars(id.data(), id.data() + id.size(), peer->id);
+  auto [portEnd, portError] =
+      std::from_chars(port.data(), port.data() + port.size(), peer->port);
+  if (idError != std::errc() || idEnd != id.data() + id.size() ||
+      portError != std::errc() || portEnd != port.data() + port.size() ||
+      peer->port <= 0 || peer->port > 65535)
+    return nullptr;
+  peer->host = entry.substr(at + 1, colon - at - 1);
+  return peer;
+}
+
+// * Binds the inter-node listener and parses the peer list.
+Cluster::Cluster(const serversett &settings) : NODE(settings.nodeId) {
+  std::stringstream peers(settings.peers);
+  std::string entry;
+  while (std::getline(peers, entry, ',')) {
+    auto peer = this->parse_peer(entry);
+    if (!peer) {
+      std::cerr << "invalid peer `" << entry << "`" << std::endl;
+      exit(8);
+    }
+    if (peer->id != this->NODE)
+      this->peers.emplace(peer->id, std::move(peer));
+  }
+
+  this->ring.add_node(this->NODE);
+  this->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int reuse = 1;
+  setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(settings.clusterPort);
+  inet_pton(AF_INET, settings.address.c_str(), &addr.sin_addr);
+  if (bind(this->listenFd, (sockaddr *)&addr, sizeof(addr)) == -1 ||
+      ::listen(this->listenFd, SOMAXCONN) == -1) {
+    std::cerr << "could not open cluster port" << std::endl;
+    exit(9);
+  }
+
+  this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+  this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = this->listenFd;
+  epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &ev);
+  ev.data.fd = this->wakeFd;
+  epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->wakeFd, &ev);
+}
+
+Cluster::~Cluster() {
+  this->stop.exchange(true);
+  uint64_t one = 1;
+  write(this->wakeFd, &one, sizeof(one));
+  if (this->worker.joinable())
+    this->worker.join();
+
+  for (auto &[id, peer] : this->peers) {
+    if (peer->fd != -1)
+      close(peer->fd);
+  }
+  for (auto &[fd, link] : this->inbound)
+    close(fd);
+  close(this->wakeFd);
+  close(this->epollFd);
+  close(this->listenFd);
+}
+
+void Cluster::start(WeakServer server) {
+  this->server = server;
+  this->memory = server.lock()->memory.get();
+  this->worker = std::thread([this]() { this->run(); });
+}
+
+uint32_t Cluster::owner_of(uint32_t channelId) {
+  std::unique_lock lock(this->mtx);
+  return this->ring.owner(channelId);
+}
+
+bool Cluster::owns(uint32_t channelId) {
+  return this->owner_of(channelId) == this->NODE;
+}
+
+// * Event loop of the cluster thread.
+// - Accepts and reads inbound links, handling frames in arrival order.
+// - Flushes every peer's batched outbound frames once per wakeup. Outbound
+// links are non-blocking and only watched for EPOLLOUT while a batch is
+// stuck, so a slow peer never keeps the thread from reading.
+// - Retries unreachable peers every RECONNECT_MS.
+void Cluster::run() {
+  uint64_t lastConnect = 0;
+  epoll_event events[32];
+  while (!this->stop) {
+    if (monotonic_ms() - lastConnect >= RECONNECT_MS) {
+      this->connect_peers();
+      lastConnect = monotonic_ms();
+    }
+
+    int nfds = epoll_wait(this->epollFd, events, 32, RECONNECT_MS);
+    for (int i = 0; i < nfds; i++) {
+      int fd = events[i].data.fd;
+      if (fd == this->listenFd) {
+        int link = accept4(this->listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (link != -1) {
+          epoll_event ev{};
+          ev.events = EPOLLIN;
+          ev.data.fd = link;
+          epoll_ctl(this->epollFd, EPOLL_CTL_ADD, link, &ev);
+          this->inbound[link] = Inbound{};
+        }
+      } else if (fd == this->wakeFd) {
+        uint64_t count;
+        read(this->wakeFd, &count, sizeof(count));
+      } else if (this->inbound.contains(fd)) {
+        this->read_inbound(fd);
+      } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        for (auto &[id, peer] : this->peers) {
+          if (peer->fd == fd)
+            this->peer_down(*peer);
+        }
+      }
+    }
+    this->flush_peers();
+  }
+}
+
+// * Dials every peer without an outbound link.
+// - A new link announces this node with HELLO and adds the peer to the ring.
+void Cluster::connect_peers() {
+  bool changed = false;
+  for (auto &[id, peer] : this->peers) {
+    if (peer->fd != -1)
+      continue;
+
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    std::string port = std::to_string(peer->port);
+    if (getaddrinfo(peer->host.c_str(), port.c_str(), &hints, &result) != 0)
+      continue;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    timeval timeout{0, CONNECT_TIMEOUT_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    bool connected = connect(fd, result->ai_addr, result->ai_addrlen) == 0;
+    freeaddrinfo(result);
+
+    std::vector<char> hello;
+    put_u32(hello, 8);
+    put_u32(hello, FRAME::HELLO);
+    put_u32(hello, this->NODE);
+    if (!connected || send(fd, hello.data(), hello.size(), MSG_NOSIGNAL) !=
+                          static_cast<ssize_t>(hello.size())) {
+      close(fd);
+      continue;
+    }
+
+    // The timeout only bounds the connect, batches are written without
+    // blocking (see flush_peer).
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    epoll_event ev{};
+    ev.data.fd = fd;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, fd, &ev);
+    {
+      std::unique_lock lock(peer->mtx);
+      peer->fd = fd;
+      peer->outbound.clear();
+      peer->overflow = false;
+      peer->watching = false;
+    }
+    {
+      std::unique_lock lock(this->mtx);
+      this->ring.add_node(id);
+    }
+    std::cout << "[DEBUG] cluster: node " << id << " up" << std::endl;
+    changed = true;
+  }
+
+  if (changed)
+    this->rebalance();
+}
+
+// * Writes every peer's pending frames, taking down the ones that failed.
+void Cluster::flush_peers() {
+  for (auto &[id, peer] : this->peers) {
+    if (!this->flush_peer(*peer))
+      this->peer_down(*peer);
+  }
+}
+
+// * Writes as much of a peer's pending frames as its socket takes.
+// - Frames queued meanwhile wait in `outbound` until the batch in `sending`
+// is fully written, then go out as the next batch.
+// - A full socket is watched for EPOLLOUT and the rest is written on a later
+// wakeup. False when the link failed or the peer's queue overflowed.
+bool Cluster::flush_peer(Peer &peer) {
+  int fd;
+  {
+    std::unique_lock lock(peer.mtx);
+    if (peer.fd == -1)
+      return true;
+    if (peer.overflow)
+      return false;
+    if (peer.sending.empty())
+      peer.sending.swap(peer.outbound);
+    fd = peer.fd;
+  }
+
+  while (peer.sent < peer.sending.size()) {
+    ssize_t n = send(fd, peer.sending.data() + peer.sent,
+                     peer.sending.size() - peer.sent,
+                     MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n > 0) {
+      peer.sent += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      this->watch_peer(peer, true);
+      return true;
+    } else {
+      return false;
+    }
+  }
+
+  this->memory->release(MemoryBudget::CLUSTER, peer.sending.size());
+  peer.sending.clear();
+  peer.sent = 0;
+  this->watch_peer(peer, false);
+  return true;
+}
+
+// * Adds or removes EPOLLOUT on a peer's outbound link. Hang-ups and errors
+// are reported either way and surface as a failed write.
+void Cluster::watch_peer(Peer &peer, bool writable) {
+  if (peer.watching == writable)
+    return;
+  epoll_event ev{};
+  if (writable)
+    ev.events = EPOLLOUT;
+  ev.data.fd = peer.fd;
+  epoll_ctl(this->epollFd, EPOLL_CTL_MOD, peer.fd, &ev);
+  peer.watching = writable;
+}
+
+// * Drops a peer from the ring and moves its channels.
+void Cluster::peer_down(Peer &peer) {
+  {
+    std::unique_lock lock(peer.mtx);
+    if (peer.fd == -1)
+      return;
+    epoll_ctl(this->epollFd, EPOLL_CTL_DEL, peer.fd, nullptr);
+    close(peer.fd);
+    peer.fd = -1;
+    this->memory->release(MemoryBudget::CLUSTER,
+                          peer.outbound.size() + peer.sending.size());
+    peer.outbound.clear();
+    peer.sending.clear();
+    peer.sent = 0;
+  }
+  {
+    std::unique_lock lock(this->mtx);
+    this->ring.remove_node(peer.id);
+  }
+  std::cout << "[DEBUG] cluster: node " << peer.id << " down" << std::endl;
+  this->rebalance();
+}
+
+// * Queues a frame for a peer: <size> <kind> <body>.
+// - The cluster thread is only woken for the first frame of a batch.
+// - Frames for unreachable peers are dropped; rebalancing recovers them.
+// - A peer whose queue would pass OUTBOUND_LIMIT, or the memory budget, is
+// flagged and taken down by the cluster thread instead of growing further.
+void Cluster::send_frame(uint32_t node, FRAME kind,
+                         const std::vector<char> &body) {
+  auto find = this->peers.find(node);
+  if (find == this->peers.end())
+    return;
+
+  Peer &peer = *find->second;
+  bool wake;
+  {
+    std::unique_lock lock(peer.mtx);
+    if (peer.fd == -1 || peer.overflow)
+      return;
+    const size_t bytes = body.size() + 8;
+    if (peer.outbound.size() + bytes > OUTBOUND_LIMIT ||
+        !this->memory->try_charge(MemoryBudget::CLUSTER, bytes)) {
+      peer.overflow = true;
+      wake = true;
+    } else {
+      wake = peer.outbound.empty();
+      put_u32(peer.outbound, body.size() + 4);
+      put_u32(peer.outbound, kind);
+      peer.outbound.insert(peer.outbound.end(), body.begin(), body.end());
+    }
+  }
+
+  if (wake) {
+    uint64_t one = 1;
+    write(this->wakeFd, &one, sizeof(one));
+  }
+}
+
+// * Reads whatever an inbound link has and handles every complete frame.
+// - A frame whose size can't hold its kind, or is larger than any peer would
+// queue (OUTBOUND_LIMIT), ends the link before anything is buffered for it.
+void Cluster::read_inbound(int fd) {
+  Inbound &link = this->inbound[fd];
+  char chunk[16384];
+  ssize_t n = recv(fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+  if (n <= 0)
+    return this->drop_inbound(fd);
+
+  link.buffer.insert(link.buffer.end(), chunk, chunk + n);
+  size_t offset = 0;
+  while (link.buffer.size() - offset >= 8) {
+    uint32_t size, kind;
+    std::memcpy(&size, link.buffer.data() + offset, 4);
+    std::memcpy(&kind, link.buffer.data() + offset + 4, 4);
+    if (size < 4 || size > OUTBOUND_LIMIT) {
+      std::cerr << "cluster: invalid frame size " << size << " from node "
+                << link.node << std::endl;
+      return this->drop_inbound(fd);
+    }
+    if (link.buffer.size() - offset - 4 < size)
+      break;
+    std::vector<char> body(link.buffer.begin() + offset + 8,
+                           link.buffer.begin() + offset + 4 + size);
+    this->handle_frame(link, static_cast<FRAME>(kind), body);
+    offset += 4 + size;
+  }
+  link.buffer.erase(link.buffer.begin(), link.buffer.begin() + offset);
+}
+
+// * Closes an inbound link and takes down the peer it came from.
+void Cluster::drop_inbound(int fd) {
+  uint32_t node = this->inbound[fd].node;
+  epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  this->inbound.erase(fd);
+  auto peer = this->peers.find(node);
+  if (peer != this->peers.end())
+    this->peer_down(*peer->second);
+}
+
+void Cluster::handle_frame(Inbound &link, FRAME kind,
+                           const std::vector<char> &body) {
+  switch (kind) {
+  case FRAME::HELLO: {
+    ByteReader reader{body};
+    link.node = reader.u32();
+    break;
+  }
+  case FRAME::JOIN:
+    this->on_join(link.node, body);
+    break;
+  case FRAME::JOINED:
+    this->on_joined(body);
+    break;
+  case FRAME::LEAVE:
+    this->on_leave(body);
+    break;
+  case FRAME::MESSAGE:
+    this->on_message(body);
+    break;
+  case FRAME::RELAY:
+    this->on_relay(body);
+    break;
+  case FRAME::MIGRATE:
+    this->on_migrate(body);
+    break;
+  case FRAME::DIRECT:
+    this->on_direct(body);
+    break;
+  }
+}
+
+// MEMBERSHIP
+
+// Proxy client standing for a remote member on the owning node.
+SharedClient Cluster::proxy(int clientId) {
+  std::unique_lock lock(this->mtx);
+  auto &proxy = this->proxies[clientId];
+  if (proxy == nullptr) {
+    proxy = std::make_shared<Client>(-1, clientId);
+    proxy->connected.store(true);
+  }
+  return proxy;
+}
+
+void Cluster::add_mirror(uint32_t channelId, uint32_t owner,
+                         const SharedClient &client) {
+  std::unique_lock lock(this->mtx);
+  this->mirrors[channelId].push_back(client);
+  this->mirrorOwners[channelId] = owner;
+}
+
+void Cluster::remove_mirror(uint32_t channelId, const SharedClient &client) {
+  std::unique_lock lock(this->mtx);
+  auto find = this->mirrors.find(channelId);
+  if (find == this->mirrors.end())
+    return;
+  std::erase_if(find->second, [&](const WeakClient &member) {
+    auto locked = member.lock();
+    return locked == nullptr || locked == client;
+  });
+  if (find->second.empty()) {
+    this->mirrors.erase(find);
+    this->mirrorOwners.erase(channelId);
+  }
+}
+
+// * Recomputes ownership after the ring changed.
+// - Local channels now owned elsewhere are sent to their new owner and their
+// local members become mirror members.
+// - Mirror members of channels whose previous owner left the ring rejoin the
+// new owner (a live previous owner migrates them itself).
+void Cluster::rebalance() {
+  auto server = this->server.lock();
+  if (server == nullptr)
+    return;
+
+  for (auto channel : server->channels->all_channels()) {
+    uint32_t owner = this->owner_of(channel->id);
+    if (owner == this->NODE)
+      continue;
+
+    std::vector<char> body;
+    std::vector<SharedClient> locals;
+    {
+      std::unique_lock lock(channel->mtx);
+      auto emperor = channel->emperor.lock();
+      put_u32(body, channel->id);
+      body.push_back(channel->secret ? 1 : 0);
+      put_u32(body, emperor != nullptr ? emperor->id : 0);
+      std::vector<int> members;
+      for (auto &member : *channel->members.load()) {
+        if (auto client = member.lock()) {
+          members.push_back(client->id);
+          if (!this->is_remote(*client))
+            locals.push_back(client);
+        }
+      }
+      put_ints(body, members);
+      put_string(body, channel->name);
+
+      // Emptied so the destructor doesn't tell members the channel is gone.
+      channel->replace_members({});
+      channel->moderators.clear();
+    }
+
+    this->send_frame(owner, FRAME::MIGRATE, body);
+    for (auto &client : locals)
+      this->add_mirror(channel->id, owner, client);
+    std::cout << "[DEBUG] cluster: " << channel->name << " moved to node "
+              << owner << std::endl;
+    server->channels->remove_channel(channel->id);
+  }
+
+  std::vector<std::pair<uint32_t, std::vector<WeakClient>>> orphaned;
+  {
+    std::unique_lock lock(this->mtx);
+    std::set<uint32_t> live;
+    for (auto &[id, peer] : this->peers) {
+      if (peer->fd != -1)
+        live.insert(id);
+    }
+
+    for (auto &[channelId, owner] : this->mirrorOwners) {
+      uint32_t next = this->ring.owner(channelId);
+      if (next == owner)
+        continue;
+      if (!live.contains(owner))
+        orphaned.emplace_back(channelId, this->mirrors[channelId]);
+      owner = next;
+    }
+
+    std::erase_if(this->proxies, [](const auto &entry) {
+      std::unique_lock lock(entry.second->mtx);
+      return entry.second->channels.empty();
+    });
+  }
+
+  for (auto &[channelId, members] : orphaned) {
+    uint32_t owner = this->owner_of(channelId);
+    for (auto &member : members) {
+      auto client = member.lock();
+      if (client == nullptr)
+        continue;
+      if (owner == this->NODE) {
+        this->remove_mirror(channelId, client);
+        client->leave_channel(channelId);
+        server->enter(client, channelId, true);
+        continue;
+      }
+      std::vector<char> body;
+      put_u32(body, 0);
+      put_u32(body, channelId);
+      body.push_back(1);
+      put_u32(body, client->id);
+      this->send_frame(owner, FRAME::JOIN, body);
+    }
+  }
+}
+
+// FORWARDING (client's node -> owner)
+
+// * JOIN: <token> <channel> <create flag> <client>
+// - The client's CH_CONNECT is answered once the owner replies.
+void Cluster::forward_join(const SharedClient &client, int requestId,
+                           uint32_t channelId, bool create) {
+  uint32_t token = this->joinTokens.fetch_add(1);
+  {
+    std::unique_lock lock(this->mtx);
+    this->pending[token] = {client, requestId, channelId};
+  }
+
+  std::vector<char> body;
+  put_u32(body, token);
+  put_u32(body, channelId);
+  body.push_back(create ? 1 : 0);
+  put_u32(body, client->id);
+  this->send_frame(this->owner_of(channelId), FRAME::JOIN, body);
+}
+
+// * LEAVE: <channel> <client>
+void Cluster::forward_leave(const SharedClient &client, uint32_t channelId) {
+  uint32_t owner = this->owner_of(channelId);
+  {
+    std::unique_lock lock(this->mtx);
+    auto find = this->mirrorOwners.find(channelId);
+    if (find != this->mirrorOwners.end())
+      owner = find->second;
+  }
+  this->remove_mirror(channelId, client);
+  client->leave_channel(channelId);
+
+  std::vector<char> body;
+  put_u32(body, channelId);
+  put_u32(body, client->id);
+  this->send_frame(owner, FRAME::LEAVE, body);
+}
+
+// * MESSAGE: <channel> <client> <message>
+void Cluster::forward_message(const SharedClient &client, uint32_t channelId,
+                              const std::string &message) {
+  std::vector<char> body;
+  put_u32(body, channelId);
+  put_u32(body, client->id);
+  body.insert(body.end(), message.begin(), message.end());
+  this->send_frame(this->owner_of(channelId), FRAME::MESSAGE, body);
+}
+
+// * RELAY: <channel> <encoded frame>
+// - Sent once per remote node that has members in the channel.
+void Cluster::relay(uint32_t node, uint32_t channelId, const Response &packet) {
+  std::vector<char> body;
+  put_u32(body, channelId);
+  body.insert(body.end(), packet.data.begin(), packet.data.end());
+  this->send_frame(node, FRAME::RELAY, body);
+}
+
+// * DIRECT: <client> <encoded frame>
+// - Sent to the node the recipient of a direct message is connected to.
+void Cluster::forward_direct(int clientId, const Response &packet) {
+  std::vector<char> body;
+  put_u32(body, clientId);
+  body.insert(body.end(), packet.data.begin(), packet.data.end());
+  this->send_frame(node_of(clientId), FRAME::DIRECT, body);
+}
+
+// HANDLERS
+
+// * Joins (or creates) a channel this node owns on behalf of a remote client.
+// - JOINED: <token> <ok> <channel info>
+void Cluster::on_join(uint32_t node, const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t token = reader.u32();
+  uint32_t channelId = reader.u32();
+  bool create = reader.u8() == 1;
+  int clientId = reader.u32();
+  auto server = this->server.lock();
+  if (!reader.ok || server == nullptr)
+    return;
+
+  auto member = this->proxy(clientId);
+  auto info = server->enter(member, channelId, create);
+  std::vector<char> reply;
+  put_u32(reply, token);
+  reply.push_back(info.has_value() ? 1 : 0);
+  if (info.has_value())
+    reply.insert(reply.end(), info->begin(), info->end());
+  this->send_frame(node, FRAME::JOINED, reply);
+}
+
+// * Completes a forwarded CH_CONNECT.
+void Cluster::on_joined(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t token = reader.u32();
+  bool ok = reader.u8() == 1;
+  std::vector<char> info = reader.rest();
+
+  PendingJoin join;
+  {
+    std::unique_lock lock(this->mtx);
+    auto find = this->pending.find(token);
+    if (find == this->pending.end())
+      return;
+    join = find->second;
+    this->pending.erase(find);
+  }
+
+  auto client = join.client.lock();
+  if (client == nullptr || !client->connected)
+    return;
+  if (!ok) {
+    client->send_packet(c_response(-1, DATAKIND::CH_CONNECT));
+    return;
+  }
+
+  this->add_mirror(join.channelId, this->owner_of(join.channelId), client);
+  client->join_channel(join.channelId);
+  client->send_packet(c_response(join.requestId, DATAKIND::CH_CONNECT, info));
+}
+
+void Cluster::on_leave(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t channelId = reader.u32();
+  int clientId = reader.u32();
+  auto server = this->server.lock();
+  if (!reader.ok || server == nullptr)
+    return;
+
+  SharedClient member;
+  {
+    std::unique_lock lock(this->mtx);
+    auto find = this->proxies.find(clientId);
+    if (find == this->proxies.end())
+      return;
+    member = find->second;
+  }
+
+  auto channel = server->channels->find_channel(channelId);
+  if (channel != nullptr && channel->disconnect_member(member))
+    server->channels->remove_channel(channelId);
+  member->leave_channel(channelId);
+
+  std::unique_lock lock(this->mtx);
+  if (member->channels.empty())
+    this->proxies.erase(clientId);
+}
+
+void Cluster::on_message(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t channelId = reader.u32();
+  int clientId = reader.u32();
+  std::vector<char> message = reader.rest();
+  auto server = this->server.lock();
+  if (!reader.ok || server == nullptr)
+    return;
+
+  SharedClient member;
+  {
+    std::unique_lock lock(this->mtx);
+    auto find = this->proxies.find(clientId);
+    if (find == this->proxies.end())
+      return;
+    member = find->second;
+  }
+
+  auto channel = server->channels->find_channel(channelId);
+  if (channel != nullptr && member->is_member(channelId))
+    channel->send_message(member, std::string(message.begin(), message.end()));
+}
+
+// * Delivers a relayed broadcast to this node's members of the channel.
+void Cluster::on_relay(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t channelId = reader.u32();
+  Response packet;
+  packet.data = reader.rest();
+  if (!reader.ok || packet.data.size() < 12)
+    return;
+  std::memcpy(&packet.id, packet.data.data() + 4, sizeof(packet.id));
+
+  std::vector<WeakClient> members;
+  {
+    std::unique_lock lock(this->mtx);
+    auto find = this->mirrors.find(channelId);
+    if (find == this->mirrors.end())
+      return;
+    members = find->second;
+  }
+
+  for (auto &member : members) {
+    auto client = member.lock();
+    if (client == nullptr)
+      continue;
+    if (!client->resuming) {
+      client->send_packet(packet, Client::BULK);
+    } else if (!client->unseen(channelId, {packet}).empty()) {
+      client->send_packet(packet, Client::BULK);
+    }
+  }
+}
+
+// * Takes ownership of a channel from its previous owner.
+// - MIGRATE: <channel> <secret> <emperor> <members> <name>
+// - Members connected here stop being mirrors and become direct members,
+// every other member is held through a proxy.
+void Cluster::on_migrate(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t channelId = reader.u32();
+  bool secret = reader.u8() == 1;
+  int emperorId = reader.u32();
+  std::vector<int> memberIds = reader.ints<int>();
+  std::string name = reader.string();
+  auto server = this->server.lock();
+  if (!reader.ok || server == nullptr)
+    return;
+
+  auto resolve = [&](int id) -> SharedClient {
+    if (node_of(id) != this->NODE)
+      return this->proxy(id);
+    auto local = server->clients->find_by_id(id);
+    if (local == std::nullopt)
+      return nullptr;
+    this->remove_mirror(channelId, *local);
+    return *local;
+  };
+
+  std::vector<SharedClient> members;
+  for (int id : memberIds) {
+    if (auto client = resolve(id))
+      members.push_back(client);
+  }
+  if (members.empty())
+    return;
+
+  auto emperor = members.front();
+  for (auto &member : members) {
+    if (member->id == emperorId)
+      emperor = member;
+  }
+
+  auto channel = server->channels->find_channel(channelId);
+  const bool created = channel == nullptr;
+  if (created) {
+    server->channels->create_channel(channelId, emperor, server);
+    channel = server->channels->find_channel(channelId);
+  }
+
+  std::unique_lock lock(channel->mtx);
+  if (created) {
+    channel->name.assign(name);
+    channel->secret.store(secret);
+    server->channels->directory.update(channelId, channel->name, secret);
+  }
+  Channel::Members joined = *channel->members.load();
+  for (auto &member : members) {
+    if (!created || member != emperor)
+      joined.push_back(member);
+    if (!member->is_member(channelId))
+      member->join_channel(channelId);
+  }
+  channel->replace_members(std::move(joined));
+}
+
+// * Delivers a direct message to a client connected to this node.
+void Cluster::on_direct(const std::vector<char> &body) {
+  ByteReader reader{body};
+  uint32_t clientId = reader.u32();
+  Response packet;
+  packet.data = reader.rest();
+  auto server = this->server.lock();
+  if (!reader.ok || server == nullptr)
+    return;
+
+  auto client = server->clients->find_by_id(clientId);
+  if (client != std::nullopt && (*client)->connected)
+    (*client)->send_packet(packet, Client::BULK);
+}
@@ -0,0 +1,211 @@
+#include "config.hpp"
+#include "topology.hpp"
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef std::function<bool(serversett &, const std::string &)> Setter;
+
+template <typename T> static bool parse_number(const std::string &in, T &out) {
+  auto [end, error] = std::from_chars(in.data(), in.data() + in.size(), out);
+  return error == std::errc() && end == in.data() + in.size();
+}
+
+template <typename T> static Setter number(T serversett::*field) {
+  return [field](serversett &settings, const std::string &value) {
+    return parse_number(value, settings.*field);
+  };
+}
+
+static Setter text(std::string serversett::*field) {
+  return [field](serversett &settings, const std::string &value) {
+    settings.*field = value;
+    return true;
+  };
+}
+
+static Setter flag(bool serversett::*field) {
+  return [field](serversett &settings, const std::string &value) {
+    if (value == "1" || value == "true" || value == "on" || value == "yes")
+      return settings.*field = true;
+    settings.*field = false;
+    return value == "0" || value == "false" || value == "off" || value == "no";
+  };
+}
+
+// Option names shared by the config file (`name = value`) and the command
+// line (`--name value` or `--name=value`).
+static const std::map<std::string_view, Setter> &options() {
+  static const std::map<std::string_view, Setter> table{
+      {"address", text(&serversett::address)},
+      {"port", number(&serversett::port)},
+      {"unix-socket", text(&serversett::unixPath)},
+      {"max-channels", number(&serversett::maxChannels)},
+      {"max-clients", number(&serversett::maxClients)},
+      {"accept-budget", number(&serversett::acceptBudget)},
+      {"memory-limit", number(&serversett::memoryLimit)},
+      {"connection-memory-limit", number(&serversett::connectionMemoryLimit)},
+      {"tcp-nodelay", flag(&serversett::tcpNoDelay)},
+      {"send-buffer", number(&serversett::sendBuffer)},
+      {"recv-buffer", number(&serversett::recvBuffer)},
+      {"keepalive", flag(&serversett::keepAlive)},
+      {"keepalive-idle", number(&serversett::keepAliveIdle)},
+      {"keepalive-interval", number(&serversett::keepAliveInterval)},
+      {"keepalive-count", number(&serversett::keepAliveCount)},
+      {"notsent-lowat", number(&serversett::notSentLowat)},
+      {"zerocopy-min", number(&serversett::zeroCopyMin)},
+      {"threads", number(&serversett::dedicatedThreads)},
+      {"pin-threads", flag(&serversett::pinThreads)},
+      {"scheduler-quantum", number(&serversett::schedulerQuantum)},
+      {"scheduler-weight", number(&serversett::schedulerWeight)},
+      {"channel-capacity", number(&serversett::channelCapacity)},
+      {"fanout-chunk", number(&serversett::fanoutChunk)},
+      {"channel-history", number(&serversett::channelHistory)},
+      {"client-rate", number(&serversett::clientRate)},
+      {"client-burst", number(&serversett::clientBurst)},
+      {"channel-rate", number(&serversett::channelRate)},
+      {"channel-burst", number(&serversett::channelBurst)},
+      {"timer-tick", number(&serversett::timerTick)},
+      {"idle-timeout", number(&serversett::idleTimeout)},
+      {"heartbeat-interval", number(&serversett::heartbeatInterval)},
+      {"handshake-timeout", number(&serversett::handshakeTimeout)},
+      {"invitation-ttl", number(&serversett::invitationTtl)},
+      {"presence-interval", number(&serversett::presenceInterval)},
+      {"resume-grace", number(&serversett::resumeGrace)},
+      {"trace-sample", number(&serversett::traceSample)},
+      {"trace-buffer", number(&serversett::traceBuffer)},
+      {"trace-path", text(&serversett::tracePath)},
+      {"trace-interval", number(&serversett::traceInterval)},
+      {"handoff", text(&serversett::handoffPath)},
+      {"takeover", text(&serversett::takeoverPath)},
+      {"node-id", number(&serversett::nodeId)},
+      {"cluster-port", number(&serversett::clusterPort)},
+      {"peers", text(&serversett::peers)},
+  };
+  return table;
+}
+
+static std::string trim(std::string_view in) {
+  size_t begin = in.find_first_not_of(" \t\r");
+  if (begin == std::string_view::npos)
+    return "";
+  size_t end = in.find_last_not_of(" \t\r");
+  return std::string(in.substr(begin, end - begin + 1));
+}
+
+static bool apply(serversett &settings, const std::string &name,
+                  const std::string &value) {
+  auto find = options().find(name);
+  if (find == options().end()) {
+    std::cerr << "unknown option `" << name << "`" << std::endl;
+    return false;
+  }
+  if (!find->second(settings, value)) {
+    std::cerr << "invalid value `" << value << "` for `" << name << "`"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// * Reads `name = value` lines, ignoring blank lines and `#` comments.
+static bool load_file(const std::string &path, serversett &settings) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "could not open config file `" << path << "`" << std::endl;
+    return false;
+  }
+
+  std::string line;
+  for (int number = 1; std::getline(file, line); number++) {
+    std::string_view view(line);
+    view = view.substr(0, view.find('#'));
+    if (trim(view).empty())
+      continue;
+
+    size_t equals = view.find('=');
+    if (equals == std::string_view::npos) {
+      std::cerr << path << ":" << number << ": expected `name = value`"
+                << std::endl;
+      return false;
+    }
+    if (!apply(settings, trim(view.substr(0, equals)),
+               trim(view.substr(equals + 1))))
+      return false;
+  }
+  return true;
+}
+
+// * Fills the settings from the config file and the command line.
+// - The config file is applied first so flags always win over it.
+// - A thread count of zero is resolved to the number of usable CPUs.
+// - Returns false on any error or on `--help`.
+bool load_settings(int argc, char *argv[], serversett &settings) {
+  std::vector<std::pair<std::string, std::string>> flags;
+  std::string config;
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg(argv[i]);
+    if (arg == "--help" || arg == "-h" || arg.substr(0, 2) != "--")
+      return false;
+
+    arg.remove_prefix(2);
+    std::string name, value;
+    size_t equals = arg.find('=');
+    if (equals != std::string_view::npos) {
+      name = arg.substr(0, equals);
+      value = arg.substr(equals + 1);
+    } else if (i + 1 < argc) {
+      name = arg;
+      value = argv[++i];
+    } else {
+      std::cerr << "missing value for `" << arg << "`" << std::endl;
+      return false;
+    }
+
+    if (name == "config") {
+      config = value;
+    } else {
+      flags.emplace_back(name, value);
+    }
+  }
+
+  if (!config.empty() && !load_file(config, settings))
+    return false;
+  for (auto &[name, value] : flags) {
+    if (!apply(settings, name, value))
+      return false;
+  }
+
+  if (settings.fanoutChunk == 0 || settings.acceptBudget == 0 ||
+      settings.schedulerQuantum == 0) {
+    std::cerr << "`fanout-chunk`, `accept-budget` and `scheduler-quantum` "
+                 "must be at least 1"
+              << std::endl;
+    return false;
+  }
+  if (settings.nodeId != 0 &&
+      (!settings.handoffPath.empty() || !settings.takeoverPath.empty())) {
+    std::cerr << "`handoff` and `takeover` are not supported with `node-id`"
+              << std::endl;
+    return false;
+  }
+  if (settings.dedicatedThreads <= 0)
+    settings.dedicatedThreads = static_cast<int>(available_cpus().size());
+  return true;
+}
+
+void print_usage(const char *program) {
+  std::cout << "usage: " << program << " [--config <file>] [--<option> <value>]"
+            << std::endl
+            << "options:";
+  for (auto &[name, setter] : options())
+    std::cout << " " << name;
+  std::cout << std::endl;
+}
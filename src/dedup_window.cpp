@@ -0,0 +1,47 @@
+#include "dedup_window.hpp"
+#include <cstdint>
+#include <vector>
+
+// * True if `id` was recorded with the same payload and is still in the
+// window.
+bool DedupWindow::contains(int32_t id, uint32_t fingerprint) const {
+  const uint32_t back = this->highest - static_cast<uint32_t>(id);
+  if (!this->started || back >= WINDOW)
+    return false;
+  return (this->bits >> back & 1) &&
+         this->fingerprints[static_cast<uint32_t>(id) % WINDOW] == fingerprint;
+}
+
+// * Records an accepted request.
+// - A higher id slides the window forward, ids too old for it are ignored.
+// - Ids wrap around: "higher" means less than 2^31 ahead.
+void DedupWindow::record(int32_t id, uint32_t fingerprint) {
+  const uint32_t next = static_cast<uint32_t>(id);
+  if (!this->started) {
+    this->started = true;
+    this->highest = next;
+    this->bits = 0;
+  }
+
+  const int32_t ahead = static_cast<int32_t>(next - this->highest);
+  if (ahead > 0) {
+    this->bits = static_cast<uint32_t>(ahead) >= WINDOW ? 0 : this->bits << ahead;
+    this->highest = next;
+  }
+
+  const uint32_t back = this->highest - next;
+  if (back >= WINDOW)
+    return;
+  this->bits |= uint64_t{1} << back;
+  this->fingerprints[next % WINDOW] = fingerprint;
+}
+
+// FNV-1a over the payload.
+uint32_t DedupWindow::fingerprint(const std::vector<uint8_t> &payload) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t byte : payload) {
+    hash ^= byte;
+    hash *= 16777619u;
+  }
+  return hash;
+}
@@ -0,0 +1,138 @@
+#include "directory.hpp"
+#include "utilities.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static std::vector<char> encode(auto begin, auto end) {
+  std::vector<char> out;
+  for (auto entry = begin; entry != end; entry++) {
+    put_u32(out, entry->id);
+    put_string(out, entry->name);
+  }
+  return out;
+}
+
+static uint32_t page_count(size_t entries) {
+  return (entries + Directory::PAGE_SIZE - 1) / Directory::PAGE_SIZE;
+}
+
+// * Adds, renames or hides a channel.
+// - Secret channels are not listed, making one secret removes it.
+void Directory::update(uint32_t channelId, const ChannelName &name,
+                       bool secret) {
+  std::unique_lock lock(this->mtx);
+  auto entries = this->current.load()->entries;
+  size_t changed = entries.size();
+  bool modified = false;
+
+  auto known = this->names.find(channelId);
+  if (known != this->names.end()) {
+    if (!secret && known->second == name)
+      return;
+    auto at = std::lower_bound(entries.begin(), entries.end(),
+                               Entry{known->second, channelId});
+    changed = at - entries.begin();
+    entries.erase(at);
+    this->names.erase(known);
+    modified = true;
+  }
+
+  if (!secret) {
+    Entry entry{name, channelId};
+    auto at = std::lower_bound(entries.begin(), entries.end(), entry);
+    changed = std::min<size_t>(changed, at - entries.begin());
+    entries.insert(at, entry);
+    this->names.emplace(channelId, entry.name);
+    modified = true;
+  }
+
+  if (modified)
+    this->publish(std::move(entries), changed);
+}
+
+// * Removes a destroyed channel.
+void Directory::remove(uint32_t channelId) {
+  std::unique_lock lock(this->mtx);
+  auto known = this->names.find(channelId);
+  if (known == this->names.end())
+    return;
+
+  auto entries = this->current.load()->entries;
+  auto at = std::lower_bound(entries.begin(), entries.end(),
+                             Entry{known->second, channelId});
+  size_t changed = at - entries.begin();
+  entries.erase(at);
+  this->names.erase(known);
+  this->publish(std::move(entries), changed);
+}
+
+// * Publishes the next snapshot.
+// - Pages before the one holding entry `changed` are shared with the current
+// snapshot, the rest are encoded again.
+void Directory::publish(std::vector<Entry> entries, size_t changed) {
+  auto previous = this->current.load();
+  auto next = std::make_shared<Snapshot>();
+  next->version = previous->version + 1;
+
+  const size_t pages = page_count(entries.size());
+  const size_t kept = std::min(changed / PAGE_SIZE, previous->pages.size());
+  next->pages.assign(previous->pages.begin(), previous->pages.begin() + kept);
+  for (size_t page = kept; page < pages; page++) {
+    auto begin = entries.begin() + page * PAGE_SIZE;
+    auto end = entries.begin() + std::min(entries.size(), (page + 1) * PAGE_SIZE);
+    next->pages.push_back(
+        std::make_shared<const std::vector<char>>(encode(begin, end)));
+  }
+
+  next->entries = std::move(entries);
+  this->current.store(std::move(next));
+}
+
+// * Returns one page of the listing.
+// - Without a prefix, the page is served as encoded in the snapshot.
+// - With one, the matching channels are a contiguous range of the sorted
+// entries, found by binary search and paged the same way.
+std::vector<char> Directory::list(uint32_t page, std::string_view prefix) const {
+  auto snapshot = this->current.load();
+  const auto &entries = snapshot->entries;
+  std::vector<char> out;
+  put_u32(out, snapshot->version);
+  put_u32(out, page);
+
+  if (prefix.empty()) {
+    put_u32(out, snapshot->pages.size());
+    if (page >= snapshot->pages.size()) {
+      put_u32(out, 0);
+      return out;
+    }
+    put_u32(out, std::min(PAGE_SIZE, entries.size() - page * PAGE_SIZE));
+    const auto &body = *snapshot->pages[page];
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+  }
+
+  auto first = std::lower_bound(
+      entries.begin(), entries.end(), prefix,
+      [](const Entry &entry, std::string_view key) { return entry.name.view() < key; });
+  auto last = std::find_if(first, entries.end(), [&](const Entry &entry) {
+    return !entry.name.view().starts_with(prefix);
+  });
+
+  const size_t matches = last - first;
+  put_u32(out, page_count(matches));
+  if (static_cast<size_t>(page) * PAGE_SIZE >= matches) {
+    put_u32(out, 0);
+    return out;
+  }
+  auto begin = first + page * PAGE_SIZE;
+  auto end = first + std::min(matches, (page + 1) * PAGE_SIZE);
+  put_u32(out, end - begin);
+  auto body = encode(begin, end);
+  out.insert(out.end(), body.begin(), body.end());
+  return out;
+}
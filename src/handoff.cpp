@@ -0,0 +1,246 @@
+#include "handoff.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+// Largest chunk of state sent per message and most fds per SCM_RIGHTS message
+// (the kernel caps a single message at 253 descriptors).
+static constexpr size_t CHUNK_SIZE{32768};
+static constexpr size_t FD_BATCH{250};
+
+static sockaddr_un unix_addr(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+// SERIALIZATION
+
+static std::vector<char> serialize(const HandoffState &state) {
+  std::vector<char> out;
+  put_u32(out, state.nextClientId);
+  put_u32(out, state.clients.size());
+  for (const auto &client : state.clients) {
+    put_u32(out, client.id);
+    put_u32(out, client.connected ? 1 : 0);
+    put_string(out, client.username);
+    put_ints(out, client.channels);
+  }
+
+  put_u32(out, state.channels.size());
+  for (const auto &channel : state.channels) {
+    put_u32(out, channel.id);
+    put_u32(out, channel.emperor);
+    put_u32(out, channel.secret ? 1 : 0);
+    put_u32(out, channel.sequence);
+    put_string(out, channel.name);
+    put_string(out, channel.pinnedMessage);
+    put_ints(out, channel.members);
+    put_ints(out, channel.moderators);
+    put_u32(out, channel.invitations.size());
+    for (const auto &invitation : channel.invitations) {
+      put_u32(out, invitation.client);
+      put_u64(out, invitation.expires);
+    }
+  }
+  return out;
+}
+
+static std::optional<HandoffState> deserialize(const std::vector<char> &data) {
+  HandoffState state;
+  ByteReader reader{data};
+  state.nextClientId = reader.u32();
+  state.clients.resize(std::min<size_t>(reader.u32(), data.size()));
+  for (auto &client : state.clients) {
+    client.id = reader.u32();
+    client.connected = reader.u32() == 1;
+    client.username = reader.string();
+    client.channels = reader.ints<uint32_t>();
+  }
+
+  state.channels.resize(std::min<size_t>(reader.u32(), data.size()));
+  for (auto &channel : state.channels) {
+    channel.id = reader.u32();
+    channel.emperor = reader.u32();
+    channel.secret = reader.u32() == 1;
+    channel.sequence = reader.u32();
+    channel.name = reader.string();
+    channel.pinnedMessage = reader.string();
+    channel.members = reader.ints<int>();
+    channel.moderators = reader.ints<int>();
+    channel.invitations.resize(std::min<size_t>(reader.u32(), data.size()));
+    for (auto &invitation : channel.invitations) {
+      invitation.client = reader.u32();
+      invitation.expires = reader.u64();
+    }
+  }
+
+  if (!reader.ok)
+    return std::nullopt;
+  return state;
+}
+
+// TRANSPORT
+
+// Sends one message carrying `data` and, optionally, descriptors.
+static bool send_message(int sock, const void *data, size_t size,
+                         const int *fds, size_t count) {
+  iovec iov{const_cast<void *>(data), size};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  std::vector<char> control;
+  if (count > 0) {
+    control.resize(CMSG_SPACE(count * sizeof(int)));
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+  }
+
+  return sendmsg(sock, &msg, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+}
+
+// Receives one message into `data`, appending any descriptors to `fds`.
+static ssize_t recv_message(int sock, void *data, size_t size,
+                            std::vector<int> &fds) {
+  iovec iov{data, size};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  std::vector<char> control(CMSG_SPACE(FD_BATCH * sizeof(int)));
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  if (received <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+    return -1;
+
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int *received = reinterpret_cast<const int *>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), received, received + count);
+    }
+  }
+  return received;
+}
+
+// * Creates the control socket a successor connects to for a takeover.
+// - A stale socket file left by a previous process is replaced. A successor
+// binds a staging path instead and renames it over the real one once the
+// handoff is done (see main.cpp).
+int handoff_listen(const std::string &path) {
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  sockaddr_un addr = unix_addr(path);
+  unlink(path.c_str());
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) == -1 || ::listen(fd, 1) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// * Connects to a running server's control socket to take it over.
+int handoff_connect(const std::string &path) {
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+
+  sockaddr_un addr = unix_addr(path);
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// * Sends the state to the successor.
+// - Header : <state size> <client count> with the TCP listener and, when
+// there is one, the Unix listener attached.
+// - State  : chunks of at most CHUNK_SIZE bytes.
+// - Fds    : batches of client sockets, in the same order as `state.clients`.
+bool handoff_send(int sock, const HandoffState &state) {
+  const std::vector<char> data = serialize(state);
+  const uint32_t header[2]{static_cast<uint32_t>(data.size()),
+                           static_cast<uint32_t>(state.clients.size())};
+  const int listeners[2]{state.listenFd, state.unixFd};
+  if (!send_message(sock, header, sizeof(header), listeners,
+                    state.unixFd != -1 ? 2 : 1))
+    return false;
+
+  for (size_t offset = 0; offset < data.size(); offset += CHUNK_SIZE) {
+    size_t size = std::min(CHUNK_SIZE, data.size() - offset);
+    if (!send_message(sock, data.data() + offset, size, nullptr, 0))
+      return false;
+  }
+
+  std::vector<int> fds;
+  for (const auto &client : state.clients)
+    fds.push_back(client.fd);
+  for (size_t offset = 0; offset < fds.size(); offset += FD_BATCH) {
+    size_t count = std::min(FD_BATCH, fds.size() - offset);
+    const char marker = 'F';
+    if (!send_message(sock, &marker, 1, fds.data() + offset, count))
+      return false;
+  }
+  return true;
+}
+
+// * Receives the state sent by `handoff_send`, with every fd replaced by the
+// descriptor received in this process.
+std::optional<HandoffState> handoff_receive(int sock) {
+  std::vector<int> listenFd;
+  uint32_t header[2]{};
+  if (recv_message(sock, header, sizeof(header), listenFd) != sizeof(header) ||
+      listenFd.empty() || listenFd.size() > 2) {
+    std::cerr << "handoff: invalid header" << std::endl;
+    return std::nullopt;
+  }
+
+  std::vector<char> data(header[0]);
+  std::vector<int> fds;
+  for (size_t offset = 0; offset < data.size();) {
+    size_t size = std::min(CHUNK_SIZE, data.size() - offset);
+    ssize_t received = recv_message(sock, data.data() + offset, size, fds);
+    if (received <= 0)
+      return std::nullopt;
+    offset += received;
+  }
+
+  while (fds.size() < header[1]) {
+    char marker;
+    if (recv_message(sock, &marker, 1, fds) <= 0) {
+      std::cerr << "handoff: missing client sockets" << std::endl;
+      return std::nullopt;
+    }
+  }
+
+  auto state = deserialize(data);
+  if (state == std::nullopt || state->clients.size() != fds.size()) {
+    std::cerr << "handoff: invalid state" << std::endl;
+    return std::nullopt;
+  }
+
+  state->listenFd = listenFd[0];
+  state->unixFd = listenFd.size() > 1 ? listenFd[1] : -1;
+  for (size_t i = 0; i < fds.size(); i++)
+    state->clients[i].fd = fds[i];
+  return state;
+}
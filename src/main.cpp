@@ -1,14 +1,53 @@
+#include "config.hpp"
+#include "handoff.hpp"
 #include "server.hpp"
+#include <cstdio>
+#include <iostream>
 #include <memory>
+#include <optional>
+#include <unistd.h>
 
-int main() {
+// See config.hpp for every option. With `--takeover <path>` this process takes
+// over the server listening on <path>, then keeps accepting successors on it.
+int main(int argc, char *argv[]) {
   serversett settings;
-  settings.port = 3000;
-  settings.maxChannels = 10;
-  settings.maxClients = 200;
-  settings.dedicatedThreads = 10;
+  if (!load_settings(argc, argv, settings)) {
+    print_usage(argv[0]);
+    return 1;
+  }
 
-  std::shared_ptr<Server> server(new Server(settings));
+  if (settings.takeoverPath.empty()) {
+    std::shared_ptr<Server> server(new Server(settings));
+    server->listen();
+    return 0;
+  }
+
+  int predecessor = handoff_connect(settings.takeoverPath);
+  if (predecessor == -1) {
+    std::cerr << "could not reach the running server" << std::endl;
+    return 6;
+  }
+
+  std::optional<HandoffState> state = handoff_receive(predecessor);
+  if (state == std::nullopt) {
+    close(predecessor);
+    return 7;
+  }
+
+  // The control socket is bound next to the predecessor's and only moved
+  // over it once the handoff is acknowledged: until then the predecessor
+  // must stay reachable in case this process never gets that far.
+  settings.handoffPath = settings.takeoverPath + ".next";
+  std::shared_ptr<Server> server(
+      new Server(settings, state->listenFd, state->unixFd));
+  server->restore(*state);
+  const char ack = 1;
+  send(predecessor, &ack, 1, MSG_NOSIGNAL);
+  close(predecessor);
+  if (rename(settings.handoffPath.c_str(), settings.takeoverPath.c_str()) ==
+      -1)
+    std::cerr << "could not move the handoff socket to `"
+              << settings.takeoverPath << "`" << std::endl;
   server->listen();
   return 0;
 }
@@ -2,10 +2,15 @@
 #include "channel.hpp"
 #include "client.hpp"
 #include "server.hpp"
+#include <cerrno>
 #include <cstdint>
+#include <cstdlib>
+#include <iostream>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <sys/random.h>
 #include <sys/types.h>
 #include <utility>
 #include <vector>
@@ -25,6 +30,7 @@ std::vector<char> ChannelManager::create_channel(uint32_t i, WeakClient c,
   }
   {
     std::unique_lock lock(this->mutex);
+    this->directory.update(i, channel->name, channel->secret);
     this->channels.emplace(i, std::move(channel));
   }
   return channelInfo;
@@ -33,6 +39,37 @@ std::vector<char> ChannelManager::create_channel(uint32_t i, WeakClient c,
 void ChannelManager::remove_channel(uint32_t i) {
   std::unique_lock lock(this->mutex);
   this->channels.erase(i);
+  this->directory.remove(i);
+}
+
+std::vector<Channel *> ChannelManager::all_channels() {
+  std::shared_lock lock(this->mutex);
+  std::vector<Channel *> all;
+  all.reserve(this->channels.size());
+  for (auto &[id, channel] : this->channels)
+    all.push_back(channel.get());
+  return all;
+}
+
+// * Registers a channel rebuilt from a handoff.
+void ChannelManager::adopt_channel(uint32_t i, std::unique_ptr<Channel> c) {
+  std::unique_lock lock(this->mutex);
+  this->directory.update(i, c->name, c->secret);
+  this->channels.emplace(i, std::move(c));
+}
+
+// * Looks several channels up at once, nullptr for the ones not hosted here.
+std::vector<Channel *>
+ChannelManager::find_channels(const std::vector<uint32_t> &ids) {
+  std::shared_lock lock(this->mutex);
+  std::vector<Channel *> found;
+  found.reserve(ids.size());
+  for (uint32_t id : ids) {
+    auto find = this->channels.find(id);
+    found.push_back(find != this->channels.end() ? find->second.get()
+                                                 : nullptr);
+  }
+  return found;
 }
 
 Channel *ChannelManager::find_channel(uint32_t i) const {
@@ -47,16 +84,62 @@ bool ClientManager::has_capacity() {
   return this->MAXCLIENTS > this->clients.size();
 }
 
-void ClientManager::add_client(int fd) {
-  auto sclient = std::make_shared<Client>(fd, this->clientIds);
+std::shared_ptr<Client>
+ClientManager::add_client(int fd, std::unique_ptr<Transport> transport) {
+  auto sclient =
+      std::make_shared<Client>(fd, this->clientIds, std::move(transport));
+  sclient->ingress.configure(this->RATE, this->BURST);
   this->clientIds.fetch_add(1);
   std::unique_lock lock(this->mutex);
-  this->clients.emplace(fd, std::move(sclient));
+  this->clients.emplace(fd, sclient);
+  this->ids.emplace(sclient->id, sclient);
+  return sclient;
+}
+
+// * Registers a client carried over from a handoff, keeping its id.
+std::shared_ptr<Client>
+ClientManager::adopt_client(int fd, int id,
+                            std::unique_ptr<Transport> transport) {
+  auto sclient = std::make_shared<Client>(fd, id, std::move(transport));
+  sclient->ingress.configure(this->RATE, this->BURST);
+  int next = this->clientIds;
+  while (next <= id && !this->clientIds.compare_exchange_weak(next, id + 1))
+    ;
+  std::unique_lock lock(this->mutex);
+  this->clients.emplace(fd, sclient);
+  this->ids.emplace(id, sclient);
+  return sclient;
+}
+
+std::vector<std::shared_ptr<Client>> ClientManager::all_clients() {
+  std::shared_lock lock(this->mutex);
+  std::vector<std::shared_ptr<Client>> all;
+  all.reserve(this->clients.size());
+  for (auto &[fd, client] : this->clients)
+    all.push_back(client);
+  return all;
 }
 
 void ClientManager::remove_client(uint32_t fd) {
   std::unique_lock lock(this->mutex);
-  this->clients.erase(fd);
+  auto find = this->clients.find(fd);
+  if (find != this->clients.end()) {
+    this->ids.erase(find->second->id);
+    this->clients.erase(find);
+  }
+}
+
+std::optional<std::shared_ptr<Client>>
+ClientManager::find_by_id(uint32_t id) {
+  std::shared_lock lock(this->mutex);
+  auto find = this->ids.find(id);
+  if (find == this->ids.end()) {
+    return std::nullopt;
+  }
+  if (auto client = find->second.lock()) {
+    return client;
+  }
+  return std::nullopt;
 }
 
 std::optional<std::shared_ptr<Client>>
@@ -67,3 +150,81 @@ ClientManager::find_client(uint32_t fd) const {
   }
   return find->second;
 }
+
+// * Returns 64 bits from the kernel's CSPRNG, never zero.
+// - Tokens are what authenticates a session takeover, so they can't come
+// from a seeded generator whose output gives its state away.
+static uint64_t random_token() {
+  uint64_t token = 0;
+  while (token == 0) {
+    ssize_t got = getrandom(&token, sizeof(token), 0);
+    if (got == -1 && errno == EINTR)
+      continue;
+    if (got != sizeof(token)) {
+      std::cerr << "could not draw a resume token" << std::endl;
+      exit(10);
+    }
+  }
+  return token;
+}
+
+// * Gives the client a new, unguessable resume token.
+uint64_t ClientManager::issue_token(Client &client) {
+  const uint64_t token = random_token();
+  std::unique_lock lock(this->mutex);
+  client.resumeToken = token;
+  return client.resumeToken;
+}
+
+// * Keeps the session of a client whose connection dropped.
+// - Its socket is forgotten, its id stays taken.
+void ClientManager::park(const std::shared_ptr<Client> &client) {
+  std::unique_lock lock(this->mutex);
+  this->clients.erase(client->fd);
+  this->sessions.emplace(client->resumeToken, client);
+}
+
+// * Hands a parked session over to a new connection.
+// - The parked client takes the connection's transport and socket, the
+// connection's own client (and id) is dropped and gets the dead transport,
+// which is closed with it.
+std::shared_ptr<Client>
+ClientManager::resume(uint64_t token,
+                      const std::shared_ptr<Client> &connection) {
+  std::unique_lock lock(this->mutex);
+  auto find = this->sessions.find(token);
+  if (find == this->sessions.end())
+    return nullptr;
+  auto client = find->second;
+  this->sessions.erase(find);
+  {
+    std::unique_lock io(client->sendMtx);
+    std::swap(client->transport, connection->transport);
+    client->fd = connection->fd;
+    client->reset_stream();
+  }
+  this->ids.erase(connection->id);
+  this->clients[client->fd] = client;
+  return client;
+}
+
+// * Ends a parked session for good, returning its client.
+std::shared_ptr<Client> ClientManager::expire(uint64_t token) {
+  std::unique_lock lock(this->mutex);
+  auto find = this->sessions.find(token);
+  if (find == this->sessions.end())
+    return nullptr;
+  auto client = find->second;
+  this->sessions.erase(find);
+  this->ids.erase(client->id);
+  return client;
+}
+
+std::vector<uint64_t> ClientManager::parked_tokens() {
+  std::shared_lock lock(this->mutex);
+  std::vector<uint64_t> all;
+  all.reserve(this->sessions.size());
+  for (auto &[token, client] : this->sessions)
+    all.push_back(token);
+  return all;
+}
@@ -0,0 +1,41 @@
+#include "memory_budget.hpp"
+#include "utilities.hpp"
+#include <cstddef>
+#include <vector>
+
+static const char *POOL_NAMES[]{"requests", "mailboxes", "cluster",
+                                "history", "outbound"};
+
+// * Charges `bytes` unless the total would cross the limit.
+bool MemoryBudget::try_charge(POOL pool, size_t bytes) {
+  size_t current = this->total.load(std::memory_order_relaxed);
+  do {
+    if (this->LIMIT > 0 && current + bytes > this->LIMIT)
+      return false;
+  } while (!this->total.compare_exchange_weak(current, current + bytes,
+                                              std::memory_order_relaxed));
+  this->pools[pool].fetch_add(bytes, std::memory_order_relaxed);
+  return true;
+}
+
+void MemoryBudget::charge(POOL pool, size_t bytes) {
+  this->total.fetch_add(bytes, std::memory_order_relaxed);
+  this->pools[pool].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void MemoryBudget::release(POOL pool, size_t bytes) {
+  this->total.fetch_sub(bytes, std::memory_order_relaxed);
+  this->pools[pool].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+std::vector<char> MemoryBudget::snapshot() const {
+  std::vector<char> out;
+  put_u64(out, this->LIMIT);
+  put_u64(out, this->total.load());
+  put_u32(out, POOLS);
+  for (size_t pool = 0; pool < POOLS; pool++) {
+    put_string(out, POOL_NAMES[pool]);
+    put_u64(out, this->pools[pool].load());
+  }
+  return out;
+}
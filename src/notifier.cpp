@@ -0,0 +1,65 @@
+#include "notifier.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+Notifier::Notifier() {
+  this->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (this->eventFd == -1) {
+    std::cerr << "could not create notifier" << std::endl;
+    exit(8);
+  }
+}
+
+// Tasks still pending are dropped: the reactor they were meant for is gone.
+Notifier::~Notifier() {
+  for (Node *node = this->head.exchange(nullptr); node != nullptr;) {
+    Node *next = node->next;
+    delete node;
+    node = next;
+  }
+  close(this->eventFd);
+}
+
+// * Queues a task for the reactor and wakes it if it isn't already due to
+// wake.
+void Notifier::post(Task task) {
+  Node *node = new Node{std::move(task), this->head.load()};
+  while (!this->head.compare_exchange_weak(node->next, node))
+    ;
+  if (node->next == nullptr) {
+    const uint64_t one = 1;
+    (void)!write(this->eventFd, &one, sizeof(one));
+  }
+}
+
+// * Runs every task posted so far, oldest first. Called by the reactor when
+// the eventfd is readable.
+// - The eventfd is reset before taking the stack: a post racing with this
+// either lands in the batch taken here or wakes the reactor again.
+// - Returns the number of tasks run.
+size_t Notifier::drain() {
+  uint64_t count = 0;
+  (void)!read(this->eventFd, &count, sizeof(count));
+
+  Node *reversed = this->head.exchange(nullptr);
+  Node *node = nullptr;
+  while (reversed != nullptr) {
+    Node *next = reversed->next;
+    reversed->next = node;
+    node = reversed;
+    reversed = next;
+  }
+
+  size_t ran = 0;
+  while (node != nullptr) {
+    Node *next = node->next;
+    node->task();
+    delete node;
+    node = next;
+    ran++;
+  }
+  return ran;
+}
@@ -0,0 +1,46 @@
+#include "rate_limiter.hpp"
+#include "utilities.hpp"
+#include <algorithm>
+#include <cstdint>
+
+// * Sets the refill rate (tokens per second) and the burst size.
+// - The bucket starts full so a fresh client is not throttled on login.
+void TokenBucket::configure(uint32_t rate, uint32_t burst) {
+  this->rate = rate;
+  this->capacity = static_cast<uint64_t>(std::max(burst, rate)) * SCALE;
+  this->capacity = std::min<uint64_t>(this->capacity, UINT32_MAX);
+  uint64_t stamp = (monotonic_ms() & UINT32_MAX) << 32;
+  this->state.store(stamp | this->capacity);
+}
+
+// * Refills the bucket based on the elapsed time and takes `tokens` from it.
+// - Returns false (without taking anything) if not enough tokens are left.
+bool TokenBucket::try_take(uint32_t tokens) {
+  if (this->rate == 0)
+    return true;
+
+  const uint64_t cost = static_cast<uint64_t>(tokens) * SCALE;
+  uint64_t current = this->state.load(std::memory_order_relaxed);
+  while (true) {
+    // Read after the state each time: a refill committed by another thread
+    // is then never later than `now`, which would wrap `elapsed` and refill
+    // the bucket to capacity.
+    const uint32_t now = static_cast<uint32_t>(monotonic_ms());
+    uint32_t last = static_cast<uint32_t>(current >> 32);
+    uint64_t available = current & UINT32_MAX;
+    uint32_t elapsed = now - last;
+
+    // Refill in whole milliseconds: rate tokens/s == rate * SCALE / 1000 per ms.
+    uint64_t refill = static_cast<uint64_t>(elapsed) * this->rate;
+    available = std::min(this->capacity, available + refill);
+
+    if (available < cost)
+      return false;
+
+    uint64_t next = (static_cast<uint64_t>(now) << 32) | (available - cost);
+    if (this->state.compare_exchange_weak(current, next,
+                                          std::memory_order_acq_rel,
+                                          std::memory_order_relaxed))
+      return true;
+  }
+}
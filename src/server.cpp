@@ -1,20 +1,26 @@
 #include "server.hpp"
 #include "channel.hpp"
 #include "client.hpp"
+#include "text.hpp"
 #include "utilities.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
 #include <cstdint>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <ostream>
-#include <shared_mutex>
 #include <string>
 #include <string_view>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <vector>
 
 // * Utilises EPOLL to monitor new inputs on the server and client's file
@@ -23,51 +29,58 @@
 // * Handles new client connections and new incoming request from already
 // stablished clients.
 void Server::listen() {
+  if (this->settings.pinThreads) {
+    pin_current_thread(available_cpus()[0]);
+  }
+  if (this->cluster != nullptr) {
+    this->cluster->start(weak_from_this());
+  }
+  this->tracer->name_thread("reactor");
+  this->flush_trace();
   std::cout << "[DEBUG] Server listening..." << std::endl;
   epoll_event events[50];
   while (true) {
     int nfds = epoll_wait(this->epollFd, events, 50, -1);
+    const uint64_t woken = this->tracer->enabled() ? Tracer::now() : 0;
     for (int i = 0; i < nfds; i++) {
       int fd = events[i].data.fd;
-      if (fd == this->serverFd) {
-        int ncfd = accept(this->serverFd, nullptr, nullptr);
-        if (ncfd != -1) {
-          if (this->clients->has_capacity()) {
-            epoll_event event;
-            event.data.fd = ncfd;
-            event.events = EPOLLIN | EPOLLONESHOT;
-            {
-              std::unique_lock lock(this->epollMtx);
-              epoll_ctl(this->epollFd, EPOLL_CTL_ADD, ncfd, &event);
-            }
-            this->clients->add_client(ncfd);
-          } else {
-            std::cout << "[DEBUG] Server client capacity full" << std::endl;
-            auto res = c_response(-3, DATAKIND::SVR_CONNECT, "server is full");
-            auto payload = res.data;
-            send(ncfd, payload.data(), payload.size(), 0);
-            continue;
-          }
-        }
+      if (fd == this->serverFd || fd == this->unixFd) {
+        this->accept_clients(fd);
+      } else if (fd == this->notifier->fd()) {
+        this->notifier->drain();
+      } else if (fd == this->timerFd) {
+        this->on_timer_tick();
+      } else if (fd == this->handoffFd) {
+        this->handoff();
       } else {
-        std::shared_lock lock(this->epollMtx);
         auto find = this->clients->find_client(fd);
         if (find != std::nullopt) {
           std::shared_ptr<Client> client = find.value();
-          this->threadPool->enqueue([this, client]() {
-            int result = this->read_incoming(client);
-            // * Result can be 0 or -1
-            // *  0 : Rearms the client's event watcher
-            // * -1 : Disconnects the client
-            if (result == 0) {
-              epoll_event event;
-              event.data.fd = client->fd;
-              event.events = EPOLLIN | EPOLLONESHOT;
-              std::unique_lock lock(this->epollMtx);
-              epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &event);
+          auto flow = ThreadPool::client_flow(client->id);
+          const uint64_t trace = this->tracer->sample();
+          const uint64_t queued = trace != 0 ? Tracer::now() : 0;
+          this->tracer->record(trace, "reactor", woken, queued);
+          const uint32_t ready = events[i].events;
+          this->threadPool->enqueue(flow, 1, [this, client, fd, ready, trace,
+                                              queued]() {
+            this->tracer->record(trace, "pool wait", queued);
+            // Rearms the client's event watcher while it stays connected,
+            // from the reactor. The socket is the one that fired: a parked
+            // client may have been resumed on another one by the time this
+            // returns. An error that is only zero-copy completions is
+            // collected without serving.
+            const bool completions =
+                !(ready & (EPOLLIN | EPOLLHUP)) &&
+                client->transport->collect_errors();
+            if (completions || this->serve(client, trace)) {
+              this->notifier->post([this, fd]() {
+                epoll_event event;
+                event.data.fd = fd;
+                event.events = EPOLLIN | EPOLLONESHOT;
+                epoll_ctl(this->epollFd, EPOLL_CTL_MOD, fd, &event);
+              });
             } else {
-              this->srv_disconnect(client);
-              epoll_ctl(this->epollFd, EPOLL_CTL_DEL, client->fd, nullptr);
+              epoll_ctl(this->epollFd, EPOLL_CTL_DEL, fd, nullptr);
             }
           });
         }
@@ -76,44 +89,156 @@ void Server::listen() {
   }
 }
 
+// * Accepts the pending connections on a listener, TCP or Unix.
+// - At most `acceptBudget` per readiness event: the listener is level
+// triggered, so whatever is left is picked up on the next turn of the loop,
+// after the events of established clients.
+// - When the server is full the connection is told so without waiting on the
+// socket and closed right away.
+void Server::accept_clients(int listener) {
+  for (uint32_t accepted = 0; accepted < this->settings.acceptBudget;) {
+    int ncfd = accept4(listener, nullptr, nullptr,
+                       SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (ncfd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        std::cerr << "accept failed: " << std::strerror(errno) << std::endl;
+      return;
+    }
+    accepted++;
+
+    if (!this->clients->has_capacity()) {
+      static const auto full =
+          c_response(-3, DATAKIND::SVR_CONNECT, "server is full");
+      send(ncfd, full.data.data(), full.data.size(),
+           MSG_DONTWAIT | MSG_NOSIGNAL);
+      close(ncfd);
+      continue;
+    }
+
+    epoll_event event;
+    event.data.fd = ncfd;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    this->attach(ncfd, this->open_transport(ncfd));
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, ncfd, &event);
+  }
+}
+
+// * Tunes an accepted client socket and wraps it, sending large broadcast
+// frames without copies when `zeroCopyMin` is set and the socket allows it.
+std::unique_ptr<Transport> Server::open_transport(int fd) {
+  tune_socket(fd, this->settings);
+  const size_t zeroCopyMin = this->settings.zeroCopyMin;
+  return std::make_unique<SocketTransport>(
+      fd, zeroCopyMin > 0 && enable_zerocopy(fd) ? zeroCopyMin : 0);
+}
+
+// * Registers a new client and arms its timers.
+// - Clients without a transport talk over the socket `fd`.
+std::shared_ptr<Client> Server::attach(int fd,
+                                       std::unique_ptr<Transport> transport) {
+  auto client = this->clients->add_client(fd, std::move(transport));
+  client->bound_control(this->memory.get(),
+                        this->settings.connectionMemoryLimit);
+  this->watch_client(client);
+  return client;
+}
+
+// * Handles one request from the client.
+// - Returns false once the client is disconnected, because its request
+// couldn't be read or it asked to leave. A lost connection leaves a session
+// the client can resume.
+// - `trace` is the request's trace id when it is sampled (see tracer.hpp).
+bool Server::serve(const std::shared_ptr<Client> &client, uint64_t trace) {
+  const int result = this->read_incoming(client, trace);
+  if (result == 0)
+    return true;
+  this->srv_disconnect(client, result == -1);
+  return false;
+}
+
 // * Read incoming client packets.
 // - Reads the first four bytes in the client's file descriptor for the size of
 // the incoming data.
 // - Resizes the buffer to match the incoming data size or disconnects the
-// client if the size is lower than one.
+// client if the size is too small for a request or larger than a connection
+// may hold (`connectionMemoryLimit`).
+// - When the buffer doesn't fit in the global memory budget the request is
+// read and dropped, and the client is told the server is busy.
 // - Reads the rest of the data into the appropriate sized buffer.
 // - Creates a Request object with the data received.
 // - Checks if the client is connected, if not, all requests received will
 // be treated as connection request until the client is connected.
 // - After connection, pass requests down to their respective handlers and
 // send back a response.
-int Server::read_incoming(std::shared_ptr<Client> client) {
+// - Returns 0 to keep serving, -1 when the connection was lost and 1 when the
+// client left or sent an invalid request.
+int Server::read_incoming(std::shared_ptr<Client> client, uint64_t trace) {
+  const uint64_t start = trace != 0 ? Tracer::now() : 0;
   int packetSize = this->read_size(client);
-  if (packetSize <= 0) {
+  if (packetSize == -1)
     return -1;
+  if (packetSize < 10 ||
+      static_cast<size_t>(packetSize) > this->settings.connectionMemoryLimit) {
+    return 1;
   }
 
+  client->lastActivity.store(monotonic_ms());
+
+  if (!this->memory->try_charge(MemoryBudget::REQUESTS, packetSize)) {
+    char discard[4096];
+    std::unique_lock lock(client->mtx);
+    for (size_t left = packetSize; left > 0;) {
+      size_t chunk = std::min(left, sizeof(discard));
+      if (!client->read_exact(discard, chunk))
+        return -1;
+      left -= chunk;
+    }
+    lock.unlock();
+    client->send_packet(c_notice(NOTICE::ERROR, "server busy"));
+    return 0;
+  }
+  MemoryCharge charge(*this->memory, MemoryBudget::REQUESTS, packetSize);
+
   std::vector<uint8_t> buffer{};
   buffer.resize(packetSize);
   {
     std::unique_lock lock(client->mtx);
-    if (recv(client->fd, buffer.data(), packetSize, 0) <= 0) {
+    if (!client->read_exact(buffer.data(), packetSize)) {
       return -1;
     }
   }
   Response response{};
   Request request(buffer);
+  request.trace = trace;
+  uint64_t handled = trace != 0 ? Tracer::now() : 0;
+  this->tracer->record(trace, "read", start, handled);
   if (!client->connected) {
-    if (request.type != DATAKIND::SVR_CONNECT) {
+    if (request.type == DATAKIND::SVR_RESUME) {
+      response = this->svr_resume(client, request);
+    } else if (request.type != DATAKIND::SVR_CONNECT) {
       response = c_response(-1, DATAKIND::SVR_CONNECT, "connection needed");
+    } else if (auto name = scan_text(request.payload.data(),
+                                     request.payload.size(), MAX_USERNAME);
+               name == std::nullopt) {
+      response = c_response(-1, DATAKIND::SVR_CONNECT, "invalid username");
     } else {
-      auto payload = request.payload;
-      std::string name(payload.begin(), payload.end());
-      std::string newName = client->change_username(name);
-      response = c_response(request.id, DATAKIND::SVR_CONNECT, newName);
+      const UserName newName = client->change_username(*name);
       std::cout << "[DEBUG] New client: `" << newName << "`" << std::endl;
       client->change_connection(true);
+      // The resume token follows the connection response.
+      std::vector<Response> packets{
+          c_response(request.id, DATAKIND::SVR_CONNECT, newName)};
+      if (this->settings.resumeGrace > 0) {
+        std::vector<char> token;
+        put_u64(token, this->clients->issue_token(*client));
+        packets.push_back(c_response(request.id, DATAKIND::SVR_RESUME, token));
+      }
+      client->send_packets(packets);
     }
+  } else if (!this->admit(client, request)) {
+    return 0;
   } else {
     std::weak_ptr<Client> wclient = client;
     switch (request.type) {
@@ -124,21 +249,71 @@ int Server::read_incoming(std::shared_ptr<Client> client) {
       response = this->ch_disconnect(wclient, request);
       break;
     case DATAKIND::SVR_DISCONNECT:
-      return -1;
+      return 1;
       break;
     case DATAKIND::CH_MESSAGE:
       response = this->ch_message(wclient, request);
       break;
+    case DATAKIND::CH_LIST:
+      response = this->ch_list(request);
+      break;
+    case DATAKIND::CH_BULK_CONNECT:
+      response = this->ch_bulk_connect(wclient, request);
+      break;
+    case DATAKIND::CH_BULK_DISCONNECT:
+      response = this->ch_bulk_disconnect(wclient, request);
+      break;
+    case DATAKIND::CH_BULK_MESSAGE:
+      response = this->ch_bulk_message(wclient, request);
+      break;
+    case DATAKIND::CL_MESSAGE:
+      response = this->cl_message(wclient, request);
+      break;
+    case DATAKIND::SVR_MEMORY:
+      response = c_response(request.id, DATAKIND::SVR_MEMORY,
+                            this->memory->snapshot());
+      break;
     }
   }
 
+  if (trace != 0) {
+    const uint64_t sent = Tracer::now();
+    this->tracer->record(trace, "handler", handled, sent);
+    handled = sent;
+  }
   if (response.size > 0) {
     client->send_packet(response);
+    this->tracer->record(trace, "send", handled);
   }
 
   return 0;
 }
 
+// * Applies the ingress token buckets before a request is dispatched.
+// - Every request costs one token from the client's bucket.
+// - CH_MESSAGE also costs one token from the target channel's bucket, bounding
+// the fan-out a channel can generate no matter how many members flood it.
+// - Throttled requests are dropped and the client is told once per episode
+// through a SVR_MESSAGE error, so the notices can't become a flood themselves.
+bool Server::admit(const std::shared_ptr<Client> &client, Request &request) {
+  bool allowed = client->ingress.try_take();
+  if (allowed && request.type == DATAKIND::CH_MESSAGE &&
+      request.payload.size() >= 4) {
+    auto pl = request.payload;
+    const uint32_t channelId = i32_from_le({pl[0], pl[1], pl[2], pl[3]});
+    auto channel = this->channels->find_channel(channelId);
+    if (channel != nullptr)
+      allowed = channel->ingress.try_take();
+  }
+
+  if (allowed) {
+    client->throttled.store(false);
+  } else if (!client->throttled.exchange(true)) {
+    client->send_packet(c_notice(NOTICE::ERROR, "rate limited"));
+  }
+  return allowed;
+}
+
 // * Reads the first four bytes on the file descriptor buffer to get the size of
 // the whole request.
 int Server::read_size(WeakClient pointer) {
@@ -147,13 +322,240 @@ int Server::read_size(WeakClient pointer) {
   buffer.resize(4);
   {
     std::unique_lock lock(client->mtx);
-    if (recv(client->fd, buffer.data(), 4, 0) <= 0) {
+    if (!client->read_exact(buffer.data(), 4)) {
       return -1;
     }
   }
   return i32_from_le(buffer);
 }
 
+// * Turns the timing wheel by the number of ticks the timerfd counted.
+void Server::on_timer_tick() {
+  uint64_t ticks = 0;
+  if (read(this->timerFd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+    this->timers->advance(ticks);
+  }
+}
+
+// * Arms the timers of a newly accepted client.
+// - Handshake: a client still not connected when it fires is told why and
+// dropped.
+// - Liveness: a single self-rescheduling timer covers heartbeats and the idle
+// timeout, so request handling only stores a timestamp.
+//
+// Clients are dropped by shutting their transport down: the reactor sees the
+// hang-up and the usual read path disconnects them, so timers never race with
+// an in-flight request.
+void Server::watch_client(std::shared_ptr<Client> client) {
+  WeakClient wclient = client;
+  if (this->settings.handshakeTimeout > 0) {
+    std::weak_ptr<Server> wserver = weak_from_this();
+    this->timers->schedule(this->settings.handshakeTimeout,
+                           [wserver, wclient]() {
+      auto server = wserver.lock();
+      auto client = wclient.lock();
+      if (server != nullptr && client != nullptr && !client->connected)
+        server->notify_later(client,
+                             c_notice(NOTICE::ERROR, "handshake timeout"),
+                             true);
+    });
+  }
+
+  this->check_liveness(wclient, client->livenessChain);
+}
+
+// * Pings silent clients and drops the ones past the idle timeout.
+// - Clients answer a heartbeat with any request (an empty SVR_MESSAGE is
+// enough), which refreshes their activity timestamp.
+// - Only the client's latest `chain` keeps rescheduling itself, so a resumed
+// session can start a fresh one without doubling the pings.
+void Server::check_liveness(const WeakClient &wclient, uint32_t chain) {
+  const uint64_t idleTimeout = this->settings.idleTimeout;
+  const uint64_t heartbeat = this->settings.heartbeatInterval;
+  if (idleTimeout == 0 && heartbeat == 0)
+    return;
+
+  auto client = wclient.lock();
+  if (client == nullptr || client->livenessChain != chain)
+    return;
+
+  const uint64_t idle = monotonic_ms() - client->lastActivity;
+  if (idleTimeout > 0 && idle >= idleTimeout) {
+    std::cout << "[DEBUG] `" << client->username << "` timed out" << std::endl;
+    client->transport->shutdown();
+    return;
+  }
+
+  uint64_t next = idleTimeout > 0 ? idleTimeout - idle : UINT64_MAX;
+  if (heartbeat > 0) {
+    if (idle >= heartbeat && client->connected) {
+      this->notify_later(client, c_notice(NOTICE::HEARTBEAT, "ping"), false);
+    }
+    next = std::min(next, idle >= heartbeat ? heartbeat : heartbeat - idle);
+  }
+
+  std::weak_ptr<Server> wserver = weak_from_this();
+  this->timers->schedule(next, [wserver, wclient, chain]() {
+    if (auto server = wserver.lock())
+      server->check_liveness(wclient, chain);
+  });
+}
+
+// * Sends a notice to a client from a pool task on the client's flow.
+// - Timers run on the reactor, and a write may wait up to IO_TIMEOUT_MS on a
+// full socket; the reactor only schedules the send.
+// - With `drop` the transport is shut down once the notice is written.
+void Server::notify_later(const std::shared_ptr<Client> &client,
+                          Response packet, bool drop) {
+  WeakClient wclient = client;
+  this->threadPool->enqueue(
+      ThreadPool::client_flow(client->id), 1,
+      [wclient, packet = std::move(packet), drop]() {
+        if (auto client = wclient.lock()) {
+          client->send_packet(packet);
+          if (drop)
+            client->transport->shutdown();
+        }
+      });
+}
+
+// * Writes the sampled traces to `tracePath` every `traceInterval`.
+// - The file is written by a pool task, the reactor only schedules it.
+void Server::flush_trace() {
+  if (!this->tracer->enabled() || this->settings.traceInterval == 0)
+    return;
+  std::weak_ptr<Server> wserver = weak_from_this();
+  this->timers->schedule(this->settings.traceInterval, [wserver]() {
+    auto server = wserver.lock();
+    if (server == nullptr)
+      return;
+    server->threadPool->enqueue([wserver]() {
+      if (auto server = wserver.lock()) {
+        if (!server->tracer->flush(server->settings.tracePath))
+          std::cerr << "could not write trace `" << server->settings.tracePath
+                    << "`" << std::endl;
+      }
+    });
+    server->flush_trace();
+  });
+}
+
+// * Hands the listening socket, every client socket and the client and
+// channel state over to a successor process.
+// - The reactor stops dispatching while this runs, then waits for in-flight
+// requests and queued broadcasts so the state is quiescent.
+// - Once the successor acknowledges, this process exits immediately: the
+// sockets stay open in the successor and clients never notice.
+// - If anything fails the handoff is abandoned and this server keeps serving.
+void Server::handoff() {
+  int successor = accept4(this->handoffFd, nullptr, nullptr, SOCK_CLOEXEC);
+  if (successor == -1)
+    return;
+
+  std::cout << "[DEBUG] Handing off to successor..." << std::endl;
+  // Parked sessions have no socket to hand over.
+  for (uint64_t token : this->clients->parked_tokens())
+    this->expire_session(token);
+  while (true) {
+    bool pending = this->threadPool->busy();
+    for (auto channel : this->channels->all_channels()) {
+      pending = pending || !channel->idle();
+    }
+    if (!pending)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  HandoffState state;
+  state.listenFd = this->serverFd;
+  state.unixFd = this->unixFd;
+  state.nextClientId = this->clients->next_id();
+  for (auto &client : this->clients->all_clients()) {
+    std::unique_lock lock(client->mtx);
+    state.clients.push_back({client->fd, client->id, client->connected,
+                             client->username.str(), client->channels});
+  }
+
+  auto id_of = [](const WeakClient &wclient) {
+    auto client = wclient.lock();
+    return client != nullptr ? client->id : -1;
+  };
+  for (auto channel : this->channels->all_channels()) {
+    std::unique_lock lock(channel->mtx);
+    ChannelState cs{};
+    cs.id = channel->id;
+    cs.emperor = id_of(channel->emperor);
+    cs.secret = channel->secret;
+    cs.sequence = channel->sequence;
+    cs.name = channel->name.str();
+    cs.pinnedMessage = channel->pinnedMessage;
+    for (auto &member : *channel->members.load())
+      cs.members.push_back(id_of(member));
+    for (auto &moderator : channel->moderators)
+      cs.moderators.push_back(id_of(moderator));
+    cs.invitations = channel->invitations;
+    state.channels.push_back(std::move(cs));
+  }
+
+  char ack = 0;
+  if (handoff_send(successor, state) && recv(successor, &ack, 1, 0) == 1) {
+    std::cout << "[DEBUG] Handoff complete, exiting." << std::endl;
+    _exit(0);
+  }
+
+  std::cerr << "handoff failed, resuming service" << std::endl;
+  close(successor);
+}
+
+// * Rebuilds the clients and channels received from a handoff.
+// - Client sockets are watched again by this reactor and their timers are
+// re-armed as if they had just connected.
+void Server::restore(const HandoffState &state) {
+  std::unordered_map<int, std::shared_ptr<Client>> byId;
+  for (const auto &cs : state.clients) {
+    auto client =
+        this->clients->adopt_client(cs.fd, cs.id, this->open_transport(cs.fd));
+    client->bound_control(this->memory.get(),
+                          this->settings.connectionMemoryLimit);
+    client->username.assign(cs.username);
+    client->channels = cs.channels;
+    client->connected.store(cs.connected);
+    byId.emplace(cs.id, client);
+  }
+
+  auto find = [&](int id) -> WeakClient {
+    auto it = byId.find(id);
+    return it != byId.end() ? WeakClient(it->second) : WeakClient();
+  };
+  for (const auto &cs : state.channels) {
+    auto channel = std::make_unique<Channel>(cs.id, find(cs.emperor),
+                                             weak_from_this());
+    channel->name.assign(cs.name);
+    channel->secret.store(cs.secret);
+    channel->sequence.store(cs.sequence);
+    channel->dispatched = cs.sequence;
+    channel->pinnedMessage = cs.pinnedMessage;
+    channel->invitations = cs.invitations;
+    Channel::Members members;
+    for (int id : cs.members)
+      members.push_back(find(id));
+    channel->replace_members(std::move(members));
+    for (int id : cs.moderators)
+      channel->moderators.push_back(find(id));
+    this->channels->adopt_channel(cs.id, std::move(channel));
+  }
+
+  for (auto &[id, client] : byId) {
+    epoll_event event;
+    event.data.fd = client->fd;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, client->fd, &event);
+    this->watch_client(client);
+  }
+  std::cout << "[DEBUG] Restored " << byId.size() << " clients and "
+            << state.channels.size() << " channels" << std::endl;
+}
+
 // * Removes the client accross the application by lowering the shared_ptr
 // counter to zero.
 //
@@ -162,24 +564,126 @@ int Server::read_size(WeakClient pointer) {
 //    - Channel -> chatters::vector
 //    - Channel -> moderators::vector
 //    - Channel -> emperor::shared_ptr
-void Server::srv_disconnect(const WeakClient &wclient) {
+//
+// * A connected client whose connection was lost (`resumable`) is parked
+// instead for `resumeGrace`: it stays in its channels, which hold its frames
+// back, until it resumes or the session expires.
+void Server::srv_disconnect(const WeakClient &wclient, bool resumable) {
   auto sclient = wclient.lock();
-  sclient->connected.exchange(false);
+  const bool wasConnected = sclient->connected.exchange(false);
+
+  if (resumable && wasConnected && this->settings.resumeGrace > 0) {
+    sclient->hold_channels();
+    this->clients->park(sclient);
+    const uint64_t token = sclient->resumeToken;
+    std::weak_ptr<Server> wserver = weak_from_this();
+    this->timers->schedule(this->settings.resumeGrace, [wserver, token]() {
+      if (auto server = wserver.lock()) {
+        server->threadPool->enqueue(
+            [server, token]() { server->expire_session(token); });
+      }
+    });
+    std::cout << "[DEBUG] `" << sclient->username
+              << "` lost its connection, session kept." << std::endl;
+    return;
+  }
+
+  this->leave_channels(sclient);
+  this->clients->remove_client(sclient->fd);
+  std::cout << "[DEBUG] `" << sclient->username << "` disconnected from server."
+            << std::endl;
+}
 
-  for (int id : sclient->channels) {
+// * Takes the client out of every channel it is in.
+void Server::leave_channels(const std::shared_ptr<Client> &sclient) {
+  // Leaving a channel edits the client's list, so iterate over a copy.
+  std::vector<uint32_t> joined;
+  {
+    std::unique_lock lock(sclient->mtx);
+    joined = sclient->channels;
+  }
+  for (int id : joined) {
     auto channel = this->channels->find_channel(id);
     if (channel != nullptr) {
       if (channel->disconnect_member(sclient)) {
         this->channels->remove_channel(id);
       }
+    } else if (this->cluster != nullptr) {
+      this->cluster->forward_leave(sclient, id);
     }
   }
+}
 
-  this->clients->remove_client(sclient->fd);
-  std::cout << "[DEBUG] `" << sclient->username << "` disconnected from server."
+// * Ends a parked session nobody resumed: the client leaves its channels.
+void Server::expire_session(uint64_t token) {
+  auto client = this->clients->expire(token);
+  if (client == nullptr)
+    return;
+  this->leave_channels(client);
+  std::cout << "[DEBUG] session of `" << client->username << "` expired."
             << std::endl;
 }
 
+// * Reattaches a new connection to a parked session.
+// * The SVR_RESUME payload is: <token> <count> { <channel> <last sequence> }
+// - The connection takes the parked client's place, with its id, name and
+// memberships. The response carries a fresh token and the client id:
+// <token> <client id> <username>
+// - Every channel then replays what was fanned out after the last sequence
+// number the client saw (see Channel::resume); channels left out of the
+// request count as NONE_SEEN and replay everything they retained.
+// - An unknown or expired token is refused and the connection stays
+// unconnected, free to SVR_CONNECT.
+Response Server::svr_resume(const std::shared_ptr<Client> &connection,
+                            Request &request) {
+  const std::vector<char> body(request.payload.begin(), request.payload.end());
+  ByteReader reader{body};
+  const uint64_t token = reader.u64();
+  std::unordered_map<uint32_t, uint32_t> lastSeen;
+  for (uint32_t count = reader.u32(); reader.ok && count > 0; count--) {
+    const uint32_t channelId = reader.u32();
+    lastSeen[channelId] = reader.u32();
+  }
+  if (!reader.ok)
+    return c_response(-1, DATAKIND::SVR_RESUME, "invalid packet");
+
+  auto client = this->clients->resume(token, connection);
+  if (client == nullptr)
+    return c_response(-1, DATAKIND::SVR_RESUME, "session expired");
+
+  client->lastActivity.store(monotonic_ms());
+  client->connected.store(true);
+  // The parked session's timers may have stopped at the idle timeout, and
+  // the ones armed for this connection watch the client it replaced.
+  this->check_liveness(client, client->livenessChain.fetch_add(1) + 1);
+  std::vector<char> payload;
+  put_u64(payload, this->clients->issue_token(*client));
+  put_u32(payload, client->id);
+  payload.insert(payload.end(), client->username.data(),
+                 client->username.data() + client->username.size());
+  client->send_packet(c_response(request.id, DATAKIND::SVR_RESUME, payload));
+
+  std::vector<uint32_t> joined;
+  {
+    std::unique_lock lock(client->mtx);
+    joined = client->channels;
+  }
+  for (uint32_t id : joined) {
+    auto find = lastSeen.find(id);
+    const uint32_t last =
+        find != lastSeen.end() ? find->second : Channel::NONE_SEEN;
+    if (auto channel = this->channels->find_channel(id)) {
+      channel->resume(client, last, request.id);
+    } else {
+      // Channels owned by other nodes keep no history here.
+      client->deliver_from(id, 0);
+    }
+  }
+  std::cout << "[DEBUG] `" << client->username << "` resumed its session."
+            << std::endl;
+  return Response{};
+}
+
 // CHANNEL RELATED REQUEST HANDLERS
 
 // * Request to join a channel.
@@ -195,31 +699,60 @@ Response Server::ch_connect(WeakClient &client, Request &request) {
 
   bool flag = body[0] == 1;
   int channelId = i32_from_le({body[1], body[2], body[3], body[4]});
-  auto channel = this->channels->find_channel(channelId);
-  // * If the channel is not found on the server's channel pool:
-  // - Check the creation flag to decide if a new channel should be created.
-  // - If the flag is false or the server MAXCHANNELS number has been
-  // reached: return a not found packet
-  // - Otherwise create the new channel with the client as the emperor.
+
+  // Channels owned by another node are joined there, the response is sent
+  // when the owner answers.
+  if (this->cluster != nullptr && !this->cluster->owns(channelId)) {
+    this->cluster->forward_join(client.lock(), request.id, channelId, flag);
+    return Response{};
+  }
+
+  auto info = this->enter(client, channelId, flag);
+  if (info.has_value()) {
+    // The roster follows the join response.
+    std::vector<Response> packets{
+        c_response(request.id, DATAKIND::CH_CONNECT, *info)};
+    if (auto channel = this->channels->find_channel(channelId))
+      packets.push_back(channel->roster(request.id));
+    client.lock()->send_packets(packets);
+    return Response{};
+  }
+  return c_response(-1, DATAKIND::CH_CONNECT);
+}
+
+// * Enters a channel hosted on this node, returning its info on success.
+// * If the channel is not found on the server's channel pool:
+// - Check the creation flag to decide if a new channel should be created.
+// - If the flag is false or the server MAXCHANNELS number has been
+// reached: the channel can't be entered.
+// - Otherwise create the new channel with the client as the emperor.
+std::optional<std::vector<char>>
+Server::enter(const WeakClient &client, uint32_t channelId, bool create) {
+  return this->enter(client, channelId, create,
+                     this->channels->find_channel(channelId));
+}
+
+// * Same, with the channel already looked up (nullptr if not hosted here).
+std::optional<std::vector<char>> Server::enter(const WeakClient &client,
+                                               uint32_t channelId, bool create,
+                                               Channel *channel) {
   if (channel == nullptr) {
-    if (flag && this->channels->has_capacity()) {
-      WeakClient weakClient = client;
+    if (create && this->channels->has_capacity()) {
       std::weak_ptr<Server> weakServer = weak_from_this();
-      auto info = channels->create_channel(channelId, weakClient, weakServer);
-      return c_response(request.id, DATAKIND::CH_CONNECT, info);
+      return channels->create_channel(channelId, client, weakServer);
     }
-    return c_response(-1, DATAKIND::CH_CONNECT);
-  } else {
-    if (channel->enter_channel(client)) {
-      auto channelInfo = channel->info();
-      auto c = client.lock();
-      c->join_channel(channelId);
-      std::cout << "[DEBUG] " << c->username << " joined `" << channel->name
-                << "`" << std::endl;
-      return c_response(request.id, DATAKIND::CH_CONNECT, channelInfo);
-    }
-    return c_response(-1, DATAKIND::CH_CONNECT);
+    return std::nullopt;
   }
+
+  if (channel->enter_channel(client)) {
+    auto channelInfo = channel->info();
+    auto c = client.lock();
+    c->join_channel(channelId);
+    std::cout << "[DEBUG] " << c->username << " joined `" << channel->name
+              << "`" << std::endl;
+    return channelInfo;
+  }
+  return std::nullopt;
 }
 
 // * Disconnects the client from the channel.
@@ -229,35 +762,216 @@ Response Server::ch_disconnect(const WeakClient &sclient, Request &request) {
     auto pl = request.payload;
     uint32_t channelId = i32_from_le({pl[0], pl[1], pl[2], pl[3]});
     auto channel = this->channels->find_channel(channelId);
-    if (channel != nullptr) {
-      std::cout << "[DEBUG] " << sclient.lock()->username
-                << " disconnected from `" << channel->name << "`" << std::endl;
-      if (channel->disconnect_member(sclient)) {
-        this->channels->remove_channel(channelId);
-      }
+    if (this->leave(sclient.lock(), channelId, channel) == OUTCOME::DONE)
       return c_response(request.id, DATAKIND::CH_DISCONNECT);
-    }
   }
 
   return c_response(-1, DATAKIND::CH_DISCONNECT);
 }
 
+// * Takes the client out of a channel, `channel` being nullptr when it isn't
+// hosted here.
+OUTCOME Server::leave(const SharedClient &client, uint32_t channelId,
+                      Channel *channel) {
+  if (channel != nullptr) {
+    std::cout << "[DEBUG] " << client->username << " disconnected from `"
+              << channel->name << "`" << std::endl;
+    if (channel->disconnect_member(client)) {
+      this->channels->remove_channel(channelId);
+    }
+    return OUTCOME::DONE;
+  }
+
+  if (this->cluster != nullptr && client->is_member(channelId)) {
+    this->cluster->forward_leave(client, channelId);
+    return OUTCOME::DONE;
+  }
+  return OUTCOME::FAILED;
+}
+
 // * Sends message in a channel.
 // - Checks if the channel exists
 // - Checks if the client is in the channel.
+// - A request with the id and payload of one of the client's recently
+// accepted messages is a retry: it is acknowledged without a second
+// broadcast (see DedupWindow).
 Response Server::ch_message(const WeakClient &client, Request &request) {
-  const auto body = request.payload;
-  const std::string message(body.begin() + 4, body.end());
+  const auto &body = request.payload;
+  if (body.size() < 4)
+    return c_response(-1, DATAKIND::CH_MESSAGE, "invalid packet");
+  const auto text = scan_text(body.data() + 4, body.size() - 4, MAX_MESSAGE);
+  if (text == std::nullopt)
+    return c_response(-1, DATAKIND::CH_MESSAGE, "invalid message");
+  const std::string message(*text);
   const uint32_t channelId = i32_from_le({body[0], body[1], body[2], body[3]});
+
+  // A retry of a message already accepted gets the same ack again.
+  auto sclient = client.lock();
+  const uint32_t fingerprint = DedupWindow::fingerprint(body);
+  if (sclient->recentMessages.contains(request.id, fingerprint))
+    return c_response(request.id, DATAKIND::CH_MESSAGE);
+
   const auto channel = this->channels->find_channel(channelId);
-  if (channel != nullptr) {
-    if (client.lock()->is_member(channelId)) {
-      channel->send_message(client, message);
-      return c_response(request.id, DATAKIND::CH_MESSAGE);
+  switch (this->post(sclient, channelId, channel, message, request.trace)) {
+  case OUTCOME::DONE:
+    sclient->recentMessages.record(request.id, fingerprint);
+    return c_response(request.id, DATAKIND::CH_MESSAGE);
+  case OUTCOME::BUSY:
+    return c_response(-1, DATAKIND::CH_MESSAGE, "server busy");
+  default:
+    return c_response(-1, DATAKIND::CH_MESSAGE);
+  }
+}
+
+// * Posts a message in a channel the client is in, `channel` being nullptr
+// when it isn't hosted here.
+OUTCOME Server::post(const SharedClient &client, uint32_t channelId,
+                     Channel *channel, const std::string &message,
+                     uint64_t trace) {
+  if (!client->is_member(channelId))
+    return OUTCOME::FAILED;
+  if (channel != nullptr)
+    return channel->send_message(client, message, trace) ? OUTCOME::DONE
+                                                         : OUTCOME::BUSY;
+  if (this->cluster != nullptr) {
+    this->cluster->forward_message(client, channelId, message);
+    return OUTCOME::DONE;
+  }
+  return OUTCOME::FAILED;
+}
+
+// BULK REQUESTS
+//
+// Bulk requests carry a list of channel ids: <count> { <channel> }. All the
+// channels are looked up in one pass over the channel manager and a single
+// response reports each one: <count> { <channel> <outcome> ... } (see
+// OUTCOME).
+
+// * Reads the channel list of a bulk request.
+// - A list naming a channel twice is refused: the channels are looked up
+// once, and handling the first entry may destroy the channel (last member
+// leaving) or create it, which the second would not see.
+static std::optional<std::vector<uint32_t>> read_channel_ids(ByteReader &reader) {
+  const uint32_t count = reader.u32();
+  if (!reader.ok || count > (reader.data.size() - reader.offset) / 4)
+    return std::nullopt;
+  std::vector<uint32_t> ids(count);
+  for (auto &id : ids)
+    id = reader.u32();
+
+  std::vector<uint32_t> sorted = ids;
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+    return std::nullopt;
+  return ids;
+}
+
+// * Joins several channels: <flag> <count> { <channel> }
+// - Each entry is <channel> <outcome>, followed for joined channels by
+// <info size> <info> (the CH_CONNECT response payload).
+// - The roster of every joined channel follows the response, all written
+// together.
+// - Channels owned by other nodes are FORWARDED: each gets its own CH_CONNECT
+// response when the owner answers.
+Response Server::ch_bulk_connect(WeakClient &client, Request &request) {
+  const std::vector<char> body(request.payload.begin(), request.payload.end());
+  ByteReader reader{body};
+  const bool create = reader.u8() == 1;
+  auto ids = read_channel_ids(reader);
+  if (ids == std::nullopt)
+    return c_response(-1, DATAKIND::CH_BULK_CONNECT, "invalid packet");
+
+  auto sclient = client.lock();
+  auto found = this->channels->find_channels(*ids);
+  std::vector<char> payload;
+  std::vector<Response> packets(1);
+  put_u32(payload, ids->size());
+  for (size_t i = 0; i < ids->size(); i++) {
+    const uint32_t channelId = (*ids)[i];
+    put_u32(payload, channelId);
+    if (this->cluster != nullptr && !this->cluster->owns(channelId)) {
+      this->cluster->forward_join(sclient, request.id, channelId, create);
+      payload.push_back(OUTCOME::FORWARDED);
+      continue;
     }
+
+    auto info = this->enter(client, channelId, create, found[i]);
+    if (info == std::nullopt) {
+      payload.push_back(OUTCOME::FAILED);
+      continue;
+    }
+    payload.push_back(OUTCOME::DONE);
+    put_u32(payload, info->size());
+    payload.insert(payload.end(), info->begin(), info->end());
+    if (auto channel = this->channels->find_channel(channelId))
+      packets.push_back(channel->roster(request.id));
   }
 
-  return c_response(-1, DATAKIND::CH_MESSAGE);
+  packets[0] = c_response(request.id, DATAKIND::CH_BULK_CONNECT, payload);
+  sclient->send_packets(packets);
+  return Response{};
+}
+
+// * Leaves several channels: <count> { <channel> }
+Response Server::ch_bulk_disconnect(const WeakClient &client,
+                                    Request &request) {
+  const std::vector<char> body(request.payload.begin(), request.payload.end());
+  ByteReader reader{body};
+  auto ids = read_channel_ids(reader);
+  if (ids == std::nullopt)
+    return c_response(-1, DATAKIND::CH_BULK_DISCONNECT, "invalid packet");
+
+  auto sclient = client.lock();
+  auto found = this->channels->find_channels(*ids);
+  std::vector<char> payload;
+  put_u32(payload, ids->size());
+  for (size_t i = 0; i < ids->size(); i++) {
+    put_u32(payload, (*ids)[i]);
+    payload.push_back(this->leave(sclient, (*ids)[i], found[i]));
+  }
+  return c_response(request.id, DATAKIND::CH_BULK_DISCONNECT, payload);
+}
+
+// * Posts one message in several channels: <count> { <channel> } <message>
+// - Each channel's ingress bucket is charged as for CH_MESSAGE, throttled
+// channels are skipped.
+// - Retries are recognised as for CH_MESSAGE and acknowledged with every
+// channel DONE.
+Response Server::ch_bulk_message(const WeakClient &client, Request &request) {
+  const std::vector<char> body(request.payload.begin(), request.payload.end());
+  ByteReader reader{body};
+  auto ids = read_channel_ids(reader);
+  if (ids == std::nullopt)
+    return c_response(-1, DATAKIND::CH_BULK_MESSAGE, "invalid packet");
+  const auto text = scan_text(body.data() + reader.offset,
+                              body.size() - reader.offset, MAX_MESSAGE);
+  if (text == std::nullopt)
+    return c_response(-1, DATAKIND::CH_BULK_MESSAGE, "invalid message");
+  const std::string message(*text);
+
+  auto sclient = client.lock();
+  const uint32_t fingerprint = DedupWindow::fingerprint(request.payload);
+  const bool retry = sclient->recentMessages.contains(request.id, fingerprint);
+  auto found = this->channels->find_channels(*ids);
+  std::vector<char> payload;
+  put_u32(payload, ids->size());
+  bool posted = false;
+  for (size_t i = 0; i < ids->size(); i++) {
+    put_u32(payload, (*ids)[i]);
+    OUTCOME outcome = OUTCOME::DONE;
+    if (!retry) {
+      if (found[i] != nullptr && !found[i]->ingress.try_take())
+        outcome = OUTCOME::THROTTLED;
+      else
+        outcome =
+            this->post(sclient, (*ids)[i], found[i], message, request.trace);
+      posted = posted || outcome == OUTCOME::DONE;
+    }
+    payload.push_back(outcome);
+  }
+  if (posted)
+    sclient->recentMessages.record(request.id, fingerprint);
+  return c_response(request.id, DATAKIND::CH_BULK_MESSAGE, payload);
 }
 
 // * Maps command request to their respective handlers
@@ -284,3 +998,64 @@ Response Server::ch_command(const WeakClient &client, Request &request) {
 
   return c_response(-1, DATAKIND::CH_MESSAGE);
 }
+
+// * Lists public channels from the directory snapshot.
+// * The LIST packet payload will be composed of: <page> <prefix>
+//  - <page>   : page index (int), PAGE_SIZE channels per page.
+//  - <prefix> : only list channels whose name starts with it (optional).
+Response Server::ch_list(Request &request) {
+  const auto body = request.payload;
+  if (body.size() < 4) {
+    return c_response(-1, DATAKIND::CH_LIST, "invalid packet");
+  }
+
+  const uint32_t page = i32_from_le({body[0], body[1], body[2], body[3]});
+  std::string_view prefix(reinterpret_cast<const char *>(body.data()) + 4,
+                          body.size() - 4);
+  prefix = prefix.substr(0, prefix.find('\0'));
+  return c_response(request.id, DATAKIND::CH_LIST,
+                    this->channels->directory.list(page, prefix));
+}
+
+// CLIENT RELATED REQUEST HANDLERS
+
+// * Sends a direct message to another client.
+// * The DM packet payload will be composed of: <client> <message>
+//  - <client>  : recipient's id (int).
+//  - <message> : message content.
+// - The recipient gets <sender id> <message> written straight to its socket,
+// no channel, queue or extra task is involved.
+// - Recipients connected to another node are reached through the cluster,
+// the sender is then acknowledged once the message is forwarded.
+Response Server::cl_message(const WeakClient &client, Request &request) {
+  const auto body = request.payload;
+  if (body.size() < 4) {
+    return c_response(-1, DATAKIND::CL_MESSAGE, "invalid packet");
+  }
+
+  const auto text = scan_text(body.data() + 4, body.size() - 4, MAX_MESSAGE);
+  if (text == std::nullopt)
+    return c_response(-1, DATAKIND::CL_MESSAGE, "invalid message");
+
+  const uint32_t target = i32_from_le({body[0], body[1], body[2], body[3]});
+  auto sender = client.lock();
+  std::vector<char> payload;
+  put_u32(payload, sender->id);
+  payload.insert(payload.end(), text->begin(), text->end());
+  auto packet = c_response(0, DATAKIND::CL_MESSAGE, payload);
+
+  std::vector<char> ack;
+  put_u32(ack, target);
+  if (this->cluster != nullptr &&
+      Cluster::node_of(target) != this->settings.nodeId) {
+    this->cluster->forward_direct(target, packet);
+    return c_response(request.id, DATAKIND::CL_MESSAGE, ack);
+  }
+
+  auto recipient = this->clients->find_by_id(target);
+  if (recipient != std::nullopt && (*recipient)->connected &&
+      (*recipient)->send_packet(packet, Client::BULK)) {
+    return c_response(request.id, DATAKIND::CL_MESSAGE, ack);
+  }
+  return c_response(-1, DATAKIND::CL_MESSAGE, "recipient not found");
+}
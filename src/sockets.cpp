@@ -0,0 +1,101 @@
+#include "sockets.hpp"
+#include "config.hpp"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static void set_option(int fd, int level, int name, int value) {
+  setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+// * Removes the socket file at `path` if a previous process left it behind.
+// - Only a socket nobody listens on any more (connecting is refused) is
+// removed. Any other file, or a socket still in use, is left alone and the
+// bind fails.
+static bool clear_stale(const std::string &path, const sockaddr_un &addr,
+                        socklen_t size) {
+  struct stat info{};
+  if (lstat(path.c_str(), &info) == -1)
+    return errno == ENOENT;
+  if (!S_ISSOCK(info.st_mode)) {
+    std::cerr << "`" << path << "` exists and is not a socket" << std::endl;
+    return false;
+  }
+
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe == -1)
+    return false;
+  bool refused = connect(probe, (const sockaddr *)&addr, size) == -1 &&
+                 errno == ECONNREFUSED;
+  close(probe);
+  if (!refused) {
+    std::cerr << "`" << path << "` is in use" << std::endl;
+    return false;
+  }
+  return unlink(path.c_str()) == 0;
+}
+
+// * A stale socket file left by a previous process is replaced (see
+// clear_stale). Abstract names vanish with their last socket, so they never
+// go stale.
+int listen_unix(const std::string &path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    return -1;
+  std::memcpy(addr.sun_path, path.data(), path.size());
+  socklen_t size = offsetof(sockaddr_un, sun_path) + path.size();
+  if (path[0] == '@') {
+    addr.sun_path[0] = '\0';
+  } else {
+    size++;
+    if (!clear_stale(path, addr, size))
+      return -1;
+  }
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (bind(fd, (sockaddr *)&addr, size) == -1 ||
+      listen(fd, SOMAXCONN) == -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Options a socket family doesn't support (e.g. TCP ones on a Unix socket)
+// are silently left alone.
+void tune_socket(int fd, const serversett &settings) {
+  set_option(fd, IPPROTO_TCP, TCP_NODELAY, settings.tcpNoDelay ? 1 : 0);
+  if (settings.sendBuffer > 0)
+    set_option(fd, SOL_SOCKET, SO_SNDBUF, settings.sendBuffer);
+  if (settings.recvBuffer > 0)
+    set_option(fd, SOL_SOCKET, SO_RCVBUF, settings.recvBuffer);
+
+  set_option(fd, SOL_SOCKET, SO_KEEPALIVE, settings.keepAlive ? 1 : 0);
+  if (settings.keepAlive) {
+    set_option(fd, IPPROTO_TCP, TCP_KEEPIDLE, settings.keepAliveIdle);
+    set_option(fd, IPPROTO_TCP, TCP_KEEPINTVL, settings.keepAliveInterval);
+    set_option(fd, IPPROTO_TCP, TCP_KEEPCNT, settings.keepAliveCount);
+  }
+
+  if (settings.notSentLowat > 0)
+    set_option(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, settings.notSentLowat);
+}
+
+bool enable_zerocopy(int fd) {
+  const int on = 1;
+  return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+}
+
+void cork_socket(int fd, bool on) {
+  set_option(fd, IPPROTO_TCP, TCP_CORK, on ? 1 : 0);
+}
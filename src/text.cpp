@@ -0,0 +1,141 @@
+#include "text.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// PLAIN PREFIX
+//
+// Counts the leading bytes in 0x01..0x7F: plain ASCII that is neither a
+// terminator nor part of a multi-byte character.
+
+static size_t plain_prefix_scalar(const char *data, size_t size) {
+  constexpr uint64_t ONES{0x0101010101010101};
+  constexpr uint64_t HIGH{0x8080808080808080};
+  size_t i = 0;
+  // Flags every word holding a zero or high byte (and maybe a few false ones
+  // past it), the byte loop below then finds the exact one.
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    if (((word - ONES) | word) & HIGH)
+      break;
+  }
+  for (; i < size; i++) {
+    const auto byte = static_cast<uint8_t>(data[i]);
+    if (byte == 0 || byte >= 0x80)
+      break;
+  }
+  return i;
+}
+
+#if defined(__x86_64__)
+// Zero bytes compare to all ones, so a zero or a high byte both set the
+// sign bit movemask collects.
+static size_t plain_prefix_sse2(const char *data, size_t size) {
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    int mask = _mm_movemask_epi8(_mm_or_si128(bytes, _mm_cmpeq_epi8(bytes, zero)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  return i + plain_prefix_scalar(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) static size_t
+plain_prefix_avx2(const char *data, size_t size) {
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    int mask = _mm256_movemask_epi8(
+        _mm256_or_si256(bytes, _mm256_cmpeq_epi8(bytes, zero)));
+    if (mask != 0)
+      return i + __builtin_ctz(mask);
+  }
+  // The tail goes to legacy SSE code, which stalls on dirty upper halves.
+  _mm256_zeroupper();
+  return i + plain_prefix_sse2(data + i, size - i);
+}
+#endif
+
+struct Scanner {
+  std::string_view name;
+  size_t (*plain_prefix)(const char *, size_t);
+};
+
+static Scanner pick_scanner() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return {"avx2", plain_prefix_avx2};
+  return {"sse2", plain_prefix_sse2};
+#else
+  return {"scalar", plain_prefix_scalar};
+#endif
+}
+
+static const Scanner scanner = pick_scanner();
+
+// UTF-8
+
+// * Length of the well-formed UTF-8 character starting `data`, zero when it
+// isn't one: stray continuation bytes, overlong forms, surrogates, code
+// points past U+10FFFF and characters cut short are all rejected.
+static size_t utf8_length(const char *data, size_t size) {
+  const auto *s = reinterpret_cast<const uint8_t *>(data);
+  auto continuation = [&](size_t i, uint8_t low = 0x80, uint8_t high = 0xBF) {
+    return i < size && s[i] >= low && s[i] <= high;
+  };
+
+  if (s[0] < 0x80)
+    return 1;
+  if (s[0] < 0xC2)
+    return 0;
+  if (s[0] < 0xE0)
+    return continuation(1) ? 2 : 0;
+  if (s[0] < 0xF0) {
+    const bool second = s[0] == 0xE0   ? continuation(1, 0xA0)
+                        : s[0] == 0xED ? continuation(1, 0x80, 0x9F)
+                                       : continuation(1);
+    return second && continuation(2) ? 3 : 0;
+  }
+  if (s[0] < 0xF5) {
+    const bool second = s[0] == 0xF0   ? continuation(1, 0x90)
+                        : s[0] == 0xF4 ? continuation(1, 0x80, 0x8F)
+                                       : continuation(1);
+    return second && continuation(2) && continuation(3) ? 4 : 0;
+  }
+  return 0;
+}
+
+// * Returns the text at the start of a payload, with its terminator when it
+// has one, so it can be relayed as sent.
+// - nullopt when it isn't valid UTF-8 or is longer than `limit` bytes
+// (terminator excluded). Nothing past `limit` is scanned.
+std::optional<std::string_view> scan_text(const void *data, size_t size,
+                                          size_t limit) {
+  const char *text = static_cast<const char *>(data);
+  const size_t bound = std::min(size, limit + 1);
+  for (size_t i = 0;;) {
+    i += scanner.plain_prefix(text + i, bound - i);
+    if (i == bound) {
+      if (size > limit)
+        return std::nullopt;
+      return std::string_view(text, size);
+    }
+    if (text[i] == '\0')
+      return std::string_view(text, i + 1);
+    const size_t length = utf8_length(text + i, bound - i);
+    if (length == 0)
+      return std::nullopt;
+    i += length;
+  }
+}
+
+// Name of the scanner picked for this CPU.
+std::string_view text_scanner() { return scanner.name; }
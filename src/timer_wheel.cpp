@@ -0,0 +1,85 @@
+#include "timer_wheel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// * Schedules a callback to run after `delayMs` milliseconds.
+// - The delay is rounded up to whole ticks and always at least one tick.
+// - Delays beyond the wheel's range are clamped to its last slot.
+TimerWheel::TimerId TimerWheel::schedule(uint64_t delayMs, Callback callback) {
+  constexpr uint64_t range = uint64_t{1} << (SLOT_BITS * LEVELS);
+  uint64_t ticks = (delayMs + this->TICK_MS - 1) / this->TICK_MS;
+  ticks = std::clamp<uint64_t>(ticks, 1, range - 1);
+
+  std::unique_lock lock(this->mtx);
+  TimerId id = this->timerIds++;
+  this->place({id, this->current + ticks, std::move(callback)});
+  return id;
+}
+
+// * Cancels a pending timer, returns false if it already fired.
+bool TimerWheel::cancel(TimerId id) {
+  std::unique_lock lock(this->mtx);
+  auto find = this->locations.find(id);
+  if (find == this->locations.end())
+    return false;
+  auto &[level, slot, it] = find->second;
+  this->levels[level][slot].erase(it);
+  this->locations.erase(find);
+  return true;
+}
+
+// * Turns the wheel `ticks` times.
+// - Higher levels cascade into lower ones whenever the level below wraps.
+// - Callbacks run after the lock is released so they can schedule new timers.
+void TimerWheel::advance(uint64_t ticks) {
+  std::vector<Callback> expired;
+  {
+    std::unique_lock lock(this->mtx);
+    for (uint64_t t = 0; t < ticks; t++) {
+      this->current++;
+      for (size_t level = 1; level < LEVELS; level++) {
+        if ((this->current & ((uint64_t{1} << (SLOT_BITS * level)) - 1)) != 0)
+          break;
+        this->cascade(level);
+      }
+
+      auto &slot = this->levels[0][this->current & (SLOTS - 1)];
+      for (auto &timer : slot) {
+        this->locations.erase(timer.id);
+        expired.push_back(std::move(timer.callback));
+      }
+      slot.clear();
+    }
+  }
+
+  for (auto &callback : expired) {
+    callback();
+  }
+}
+
+// Puts a timer in the lowest level whose range covers its deadline.
+void TimerWheel::place(Timer timer) {
+  uint64_t delta = timer.deadline - this->current;
+  size_t level = 0;
+  while (level < LEVELS - 1 && delta >= (uint64_t{1} << (SLOT_BITS * (level + 1))))
+    level++;
+
+  size_t slot = (timer.deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+  auto &list = this->levels[level][slot];
+  TimerId id = timer.id;
+  list.push_back(std::move(timer));
+  this->locations[id] = {level, slot, std::prev(list.end())};
+}
+
+// Re-hashes the current slot of a level into the levels below it.
+void TimerWheel::cascade(size_t level) {
+  size_t slot = (this->current >> (SLOT_BITS * level)) & (SLOTS - 1);
+  std::list<Timer> timers = std::move(this->levels[level][slot]);
+  this->levels[level][slot].clear();
+  for (auto &timer : timers) {
+    this->place(std::move(timer));
+  }
+}
@@ -0,0 +1,31 @@
+#include "topology.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+std::vector<int> available_cpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set))
+        cpus.push_back(cpu);
+    }
+  }
+
+  if (cpus.empty()) {
+    unsigned count = std::thread::hardware_concurrency();
+    for (unsigned cpu = 0; cpu < (count > 0 ? count : 1); cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+bool pin_current_thread(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,135 @@
+#include "tracer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <tuple>
+
+static std::atomic_uint64_t tracers{0};
+
+Tracer::Tracer(uint32_t sample, size_t capacity)
+    : SAMPLE(sample), CAPACITY(std::max<size_t>(capacity, 1)),
+      ID(tracers.fetch_add(1) + 1) {}
+
+uint64_t Tracer::now() {
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+// * Returns the trace id of the next request, zero when it isn't sampled.
+uint64_t Tracer::sample() {
+  if (this->SAMPLE == 0)
+    return 0;
+  const uint64_t count = this->requests.fetch_add(1, std::memory_order_relaxed);
+  return count % this->SAMPLE == 0 ? count / this->SAMPLE + 1 : 0;
+}
+
+// * Returns the calling thread's ring, registering it on first use.
+// - The last ring used is cached per thread; a thread that records for
+// several tracers finds its ring again by its id.
+Tracer::Ring &Tracer::ring() {
+  thread_local uint64_t owner = 0;
+  thread_local Ring *cached = nullptr;
+  if (owner == this->ID)
+    return *cached;
+
+  std::unique_lock lock(this->mtx);
+  const auto self = std::this_thread::get_id();
+  auto find = std::find_if(this->rings.begin(), this->rings.end(),
+                           [&](const auto &ring) { return ring->owner == self; });
+  if (find == this->rings.end()) {
+    auto ring = std::make_unique<Ring>();
+    ring->owner = self;
+    ring->tid = this->rings.size() + 1;
+    ring->name = "thread " + std::to_string(ring->tid);
+    ring->spans.resize(this->CAPACITY);
+    this->rings.push_back(std::move(ring));
+    find = this->rings.end() - 1;
+  }
+  owner = this->ID;
+  cached = find->get();
+  return *cached;
+}
+
+// * Records a span of a sampled request, ignored for a trace id of zero.
+// - Stage names must outlive the tracer, they are stored as given.
+void Tracer::record(uint64_t trace, const char *stage, uint64_t start,
+                    uint64_t end) {
+  if (trace == 0)
+    return;
+  Ring &ring = this->ring();
+  std::unique_lock lock(ring.mtx);
+  ring.spans[ring.written++ % this->CAPACITY] = {trace, stage, start, end};
+}
+
+// Names the calling thread in the exported traces.
+void Tracer::name_thread(std::string name) {
+  if (!this->enabled())
+    return;
+  Ring &ring = this->ring();
+  std::unique_lock lock(this->mtx);
+  ring.name = std::move(name);
+}
+
+// * Writes every ring to `path` as a Chrome trace-event JSON file.
+// - The file is written next to `path` and renamed over it, so readers never
+// see a partial trace.
+// - Rings are only locked while copied, recording threads don't wait on IO.
+bool Tracer::flush(const std::string &path) {
+  struct Event {
+    Span span;
+    uint32_t tid;
+  };
+  std::vector<Event> events;
+  std::vector<std::pair<uint32_t, std::string>> threads;
+  {
+    std::unique_lock lock(this->mtx);
+    for (const auto &ring : this->rings) {
+      threads.emplace_back(ring->tid, ring->name);
+      std::unique_lock ringLock(ring->mtx);
+      const uint64_t count = std::min<uint64_t>(ring->written, this->CAPACITY);
+      for (uint64_t i = ring->written - count; i < ring->written; i++)
+        events.push_back({ring->spans[i % this->CAPACITY], ring->tid});
+    }
+  }
+  std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+    return std::tie(a.span.trace, a.span.start) <
+           std::tie(b.span.trace, b.span.start);
+  });
+
+  const std::string temporary = path + ".tmp";
+  std::ofstream out(temporary, std::ios::trunc);
+  if (!out)
+    return false;
+
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  const char *separator = "\n";
+  for (const auto &[tid, name] : threads) {
+    out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+        << "\"tid\":" << tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+    separator = ",\n";
+  }
+  for (size_t i = 0; i < events.size(); i++) {
+    const auto &[span, tid] = events[i];
+    out << separator << "{\"name\":\"" << span.stage
+        << "\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+        << ",\"ts\":" << span.start << ",\"dur\":" << span.end - span.start
+        << ",\"args\":{\"trace\":" << span.trace << "}}";
+
+    // Flow arrows from each span of a trace to the next one.
+    const bool first = i == 0 || events[i - 1].span.trace != span.trace;
+    const bool last =
+        i + 1 == events.size() || events[i + 1].span.trace != span.trace;
+    if (first && last)
+      continue;
+    out << ",\n{\"name\":\"request\",\"cat\":\"request\",\"ph\":\""
+        << (first ? "s" : last ? "f" : "t") << "\",\"id\":" << span.trace
+        << ",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << span.start
+        << (last ? ",\"bp\":\"e\"}" : "}");
+  }
+  out << "\n]}\n";
+  out.close();
+  if (!out)
+    return false;
+  return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,200 @@
+#include "transport.hpp"
+#include "sockets.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// SOCKET
+
+// * Waits until the socket is ready for `events`, false on timeout or error.
+// - Zero-copy completions raise POLLERR too: they are collected and the wait
+// resumed, any other error ends it.
+bool SocketTransport::wait_ready(short events) {
+  while (true) {
+    pollfd pfd{this->fd, events, 0};
+    int ready;
+    do {
+      ready = poll(&pfd, 1, SocketTransport::IO_TIMEOUT_MS);
+    } while (ready == -1 && errno == EINTR);
+    if (ready != 1)
+      return false;
+    if (pfd.revents & events)
+      return true;
+    if (!(pfd.revents & POLLERR) || !this->collect_errors())
+      return false;
+  }
+}
+
+SocketTransport::~SocketTransport() { close(this->fd); }
+
+bool SocketTransport::read_exact(void *buffer, size_t size) {
+  char *out = static_cast<char *>(buffer);
+  size_t received = 0;
+  while (received < size) {
+    ssize_t n = recv(this->fd, out + received, size - received, 0);
+    if (n > 0) {
+      received += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!this->wait_ready(POLLIN))
+        return false;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+// * Sends the whole buffer.
+// - A failed or timed out send may leave part of a frame on the wire, the
+// next frame would then be read as its rest: the stream is ended instead.
+bool SocketTransport::write_all(const char *data, size_t size) {
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = send(this->fd, data + sent, size - sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!this->wait_ready(POLLOUT))
+        return this->abort_stream();
+    } else {
+      return this->abort_stream();
+    }
+  }
+  return true;
+}
+
+// * Ends a stream that lost a write, always false. The reactor sees the
+// hang-up and disconnects the client.
+bool SocketTransport::abort_stream() {
+  this->shutdown();
+  return false;
+}
+
+// * Sends with MSG_ZEROCOPY, holding `owner` until the kernel is done.
+// - A send the kernel can't pin memory for (ENOBUFS) falls back to a copy.
+// - Failures end the stream, as for write_all.
+bool SocketTransport::write_shared(const char *data, size_t size,
+                                   const std::shared_ptr<const void> &owner) {
+  std::unique_lock lock(this->zeroCopyMtx);
+  if (this->zeroCopyMin == 0 || size < this->zeroCopyMin) {
+    lock.unlock();
+    return this->write_all(data, size);
+  }
+  lock.unlock();
+
+  size_t sent = 0;
+  while (sent < size) {
+    ssize_t n = send(this->fd, data + sent, size - sent,
+                     MSG_NOSIGNAL | MSG_ZEROCOPY);
+    if (n > 0) {
+      sent += n;
+      lock.lock();
+      this->inFlight.emplace_back(this->zeroCopySends++, owner);
+      lock.unlock();
+    } else if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1 && errno == ENOBUFS) {
+      return this->write_all(data + sent, size - sent);
+    } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (!this->wait_ready(POLLOUT))
+        return this->abort_stream();
+    } else {
+      return this->abort_stream();
+    }
+  }
+  return true;
+}
+
+// * Releases the owners of the zero-copy sends the kernel has completed.
+// - Completions report ranges of send numbers [ee_info, ee_data].
+bool SocketTransport::collect_errors() {
+  std::unique_lock lock(this->zeroCopyMtx);
+  bool reaped = false;
+  while (true) {
+    char control[128];
+    msghdr msg{};
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(this->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+      return reaped;
+
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+        continue;
+      sock_extended_err error;
+      std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+      if (error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+        continue;
+
+      reaped = true;
+      const uint32_t first = error.ee_info;
+      const uint32_t span = error.ee_data - first;
+      std::erase_if(this->inFlight, [&](const auto &send) {
+        return send.first - first <= span;
+      });
+      if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+        this->zeroCopyMin = 0;
+    }
+  }
+}
+
+void SocketTransport::cork(bool on) { cork_socket(this->fd, on); }
+
+void SocketTransport::shutdown() { ::shutdown(this->fd, SHUT_RDWR); }
+
+// MEMORY
+
+void MemoryTransport::deliver(const std::vector<char> &data) {
+  std::unique_lock lock(this->mtx);
+  this->inbound.insert(this->inbound.end(), data.begin(), data.end());
+}
+
+size_t MemoryTransport::readable() {
+  std::unique_lock lock(this->mtx);
+  return this->inbound.size();
+}
+
+bool MemoryTransport::closed() {
+  std::unique_lock lock(this->mtx);
+  return this->hungUp;
+}
+
+bool MemoryTransport::read_exact(void *buffer, size_t size) {
+  std::unique_lock lock(this->mtx);
+  if (this->hungUp || this->inbound.size() < size)
+    return false;
+  auto end = this->inbound.begin() + size;
+  std::copy(this->inbound.begin(), end, static_cast<char *>(buffer));
+  this->inbound.erase(this->inbound.begin(), end);
+  return true;
+}
+
+bool MemoryTransport::write_all(const char *data, size_t size) {
+  std::unique_lock lock(this->mtx);
+  if (this->hungUp)
+    return false;
+  this->bytesWritten += size;
+  for (size_t i = 0; i < size; i++) {
+    this->hash ^= static_cast<uint8_t>(data[i]);
+    this->hash *= 1099511628211ull;
+  }
+  return true;
+}
+
+void MemoryTransport::shutdown() {
+  std::unique_lock lock(this->mtx);
+  this->hungUp = true;
+}
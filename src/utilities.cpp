@@ -1,8 +1,40 @@
 #include "utilities.hpp"
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <string_view>
 
+// Replaces the steady clock, e.g. with a simulation's virtual one.
+static std::atomic<uint64_t (*)()> clockOverride{nullptr};
+
+void set_clock(uint64_t (*clock)()) { clockOverride.store(clock); }
+
+// Milliseconds on the steady clock, used for timeouts and rate limiting.
+uint64_t monotonic_ms() {
+  if (auto clock = clockOverride.load())
+    return clock();
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+void put_u32(std::vector<char> &out, uint32_t value) {
+  char bytes[4];
+  std::memcpy(bytes, &value, 4);
+  out.insert(out.end(), bytes, bytes + 4);
+}
+
+void put_u64(std::vector<char> &out, uint64_t value) {
+  char bytes[8];
+  std::memcpy(bytes, &value, 8);
+  out.insert(out.end(), bytes, bytes + 8);
+}
+
+void put_string(std::vector<char> &out, std::string_view value) {
+  put_u32(out, value.size());
+  out.insert(out.end(), value.begin(), value.end());
+}
+
 int i32_from_le(const std::vector<uint8_t> bytes) {
   return static_cast<int>(bytes[0] | bytes[1] << 8 | bytes[2] << 16 |
                           bytes[3] << 24);
@@ -93,23 +125,37 @@ Response c_response(const int32_t id, const uint32_t type,
   return packet;
 }
 
+// Creates a SVR_MESSAGE packet: <kind> <null-terminated message>
+Response c_notice(const NOTICE kind, const std::string_view message) {
+  std::vector<char> payload(message.size() + 2);
+  payload[0] = static_cast<char>(kind);
+  std::memcpy(payload.data() + 1, message.data(), message.size());
+  return c_response(0, DATAKIND::SVR_MESSAGE, payload);
+}
+
+// * Splits on newlines, dropping null bytes.
+// - Separators are found with memchr, which libc vectorizes, and each line is
+// copied in runs between null bytes instead of byte by byte.
 std::vector<std::vector<uint8_t>> split_newline(std::vector<uint8_t> &data) {
   std::vector<std::vector<uint8_t>> lines;
-  std::vector<uint8_t> current;
-
-  for (auto byte : data) {
-    if (byte == '\n') {
-      lines.push_back(current);
-      current.clear();
-    } else if (byte == 0x00) {
-      continue;
-    } else {
-      current.push_back(byte);
+  const uint8_t *begin = data.data();
+  const uint8_t *end = begin + data.size();
+  while (begin < end) {
+    auto newline =
+        static_cast<const uint8_t *>(std::memchr(begin, '\n', end - begin));
+    const uint8_t *stop = newline != nullptr ? newline : end;
+
+    std::vector<uint8_t> line;
+    line.reserve(stop - begin);
+    for (const uint8_t *run = begin; run < stop;) {
+      auto null = static_cast<const uint8_t *>(std::memchr(run, 0, stop - run));
+      const uint8_t *runEnd = null != nullptr ? null : stop;
+      line.insert(line.end(), run, runEnd);
+      run = runEnd + (null != nullptr ? 1 : 0);
     }
+    if (newline != nullptr || !line.empty())
+      lines.push_back(std::move(line));
+    begin = stop + 1;
   }
-
-  if (!current.empty())
-    lines.push_back(current);
-
   return lines;
 }
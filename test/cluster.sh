@@ -0,0 +1,37 @@
+#!/usr/bin/env bash
+# Starts a cluster of rc nodes on localhost for manual and scripted testing.
+#
+#   test/cluster.sh [nodes] [binary]
+#
+# Node N serves clients on port 3000+N and links to the other nodes on port
+# 4000+N. The script waits until every node accepts clients, prints the
+# client ports, and stops all nodes on Ctrl-C or when one of them exits.
+# Logs go to cluster-N.log in the current directory.
+set -eu
+
+NODES=${1:-3}
+BINARY=${2:-./build/rc}
+
+PEERS=""
+for n in $(seq 1 "$NODES"); do
+  PEERS="${PEERS:+$PEERS,}$n@127.0.0.1:$((4000 + n))"
+done
+
+PIDS=()
+trap 'kill "${PIDS[@]}" 2>/dev/null; wait' EXIT INT TERM
+
+for n in $(seq 1 "$NODES"); do
+  "$BINARY" --port $((3000 + n)) --node-id "$n" \
+    --cluster-port $((4000 + n)) --peers "$PEERS" >"cluster-$n.log" 2>&1 &
+  PIDS+=($!)
+done
+
+for n in $(seq 1 "$NODES"); do
+  for _ in $(seq 1 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/$((3000 + n))) 2>/dev/null && break
+    sleep 0.1
+  done
+  echo "node $n: 127.0.0.1:$((3000 + n))"
+done
+
+wait -n
@@ -0,0 +1,184 @@
+// Deterministic in-process simulation of the server.
+//
+// Clients talk to the real handlers through MemoryTransport instead of
+// sockets, the server runs in manual drive mode (no listener, no pool workers,
+// no channel threads) and time comes from a virtual clock, so everything runs
+// on this thread in an order fixed by the seed. Two runs with the same
+// arguments produce the same digest: a changed digest means changed output,
+// a changed rate with the same digest is a pure performance change.
+//
+// usage: rc_simulation [clients] [channels] [messages] [seed]
+//
+// Built with `-DRC_BUILD_SIMULATION=ON`.
+#include "server.hpp"
+#include "transport.hpp"
+#include "utilities.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static uint64_t virtualNow{0};
+static uint64_t virtual_clock() { return virtualNow; }
+
+struct SimClient {
+  std::shared_ptr<Client> client;
+  MemoryTransport *transport;
+  int channel;
+};
+
+// Frames a request the way clients put it on the wire:
+// <size> <id> <type> <payload> followed by two trailing zero bytes.
+static std::vector<char> request(int32_t id, uint32_t type,
+                                 const std::vector<char> &payload) {
+  std::vector<char> out;
+  put_u32(out, payload.size() + 10);
+  put_u32(out, id);
+  put_u32(out, type);
+  out.insert(out.end(), payload.begin(), payload.end());
+  out.push_back('\x00');
+  out.push_back('\x00');
+  return out;
+}
+
+// * Runs the server until nothing is left to do: every pending request is
+// served, then pool tasks and channel batches run until both are drained.
+// - The clock moves one millisecond per call and the timing wheel turns on
+// every full tick.
+static uint64_t drive(Server &server, std::vector<SimClient> &clients) {
+  uint64_t served = 0;
+  for (auto &sim : clients) {
+    while (sim.transport->readable() > 0 && server.serve(sim.client))
+      served++;
+  }
+
+  auto channels = server.channels->all_channels();
+  for (bool progress = true; progress;) {
+    progress = false;
+    while (server.threadPool->run_one())
+      progress = true;
+    for (auto channel : channels)
+      progress = channel->pump() || progress;
+  }
+
+  virtualNow++;
+  if (virtualNow % server.timers->tick_ms() == 0)
+    server.timers->advance(1);
+  return served;
+}
+
+static uint64_t argument(int argc, char *argv[], int index, uint64_t fallback) {
+  return argc > index ? std::strtoull(argv[index], nullptr, 10) : fallback;
+}
+
+int main(int argc, char *argv[]) {
+  const uint64_t clientCount = argument(argc, argv, 1, 1000);
+  const uint64_t channelCount = argument(argc, argv, 2, 10);
+  const uint64_t messageCount = argument(argc, argv, 3, 100000);
+  const uint64_t seed = argument(argc, argv, 4, 1);
+  if (clientCount == 0 || channelCount == 0) {
+    std::cerr << "usage: " << argv[0]
+              << " [clients] [channels] [messages] [seed]" << std::endl;
+    return 1;
+  }
+
+  // Rate limits and liveness timeouts are disabled: the harness measures the
+  // request and fan-out paths, not how fast clients are allowed to go.
+  // Resumption is too, its tokens are random.
+  serversett settings;
+  settings.manualDrive = true;
+  settings.maxClients = clientCount;
+  settings.maxChannels = channelCount;
+  settings.channelCapacity = clientCount;
+  settings.clientRate = 0;
+  settings.channelRate = 0;
+  settings.idleTimeout = 0;
+  settings.heartbeatInterval = 0;
+  settings.resumeGrace = 0;
+  settings.memoryLimit = 0;
+
+  set_clock(virtual_clock);
+  std::ostringstream silenced;
+  std::streambuf *console = std::cout.rdbuf(silenced.rdbuf());
+
+  auto server = std::make_shared<Server>(settings);
+  std::vector<SimClient> clients;
+  clients.reserve(clientCount);
+  for (uint64_t i = 0; i < clientCount; i++) {
+    auto transport = std::make_unique<MemoryTransport>();
+    MemoryTransport *raw = transport.get();
+    auto client = server->attach(1000 + i, std::move(transport));
+    clients.push_back({client, raw, static_cast<int>(i % channelCount) + 1});
+  }
+
+  // Every client connects and joins its channel, the first one in creates it.
+  for (auto &sim : clients) {
+    std::string name = "sim" + std::to_string(sim.client->id);
+    sim.transport->deliver(request(1, DATAKIND::SVR_CONNECT,
+                                   std::vector<char>(name.begin(), name.end())));
+    std::vector<char> join{1};
+    put_u32(join, sim.channel);
+    sim.transport->deliver(request(2, DATAKIND::CH_CONNECT, join));
+  }
+  drive(*server, clients);
+  // Let the join presence deltas go out before measuring.
+  for (uint64_t t = 0; t <= settings.presenceInterval; t++)
+    drive(*server, clients);
+
+  // Messages are sent in rounds of one per channel on average, each from a
+  // sender picked by the seeded generator.
+  std::mt19937_64 random(seed);
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t served = 0;
+  for (uint64_t sent = 0; sent < messageCount;) {
+    for (uint64_t r = 0; r < channelCount && sent < messageCount; r++, sent++) {
+      auto &sim = clients[random() % clientCount];
+      std::vector<char> payload;
+      put_u32(payload, sim.channel);
+      std::string text = "message " + std::to_string(sent);
+      payload.insert(payload.end(), text.begin(), text.end());
+      sim.transport->deliver(request(3, DATAKIND::CH_MESSAGE, payload));
+    }
+    served += drive(*server, clients);
+  }
+  const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+          .count();
+
+  // Everyone leaves, which tears the channels down through the usual path.
+  for (auto &sim : clients)
+    sim.transport->deliver(request(4, DATAKIND::SVR_DISCONNECT, {}));
+  drive(*server, clients);
+
+  uint64_t bytes = 0;
+  uint64_t digest = 14695981039346656037ull;
+  for (auto &sim : clients) {
+    bytes += sim.transport->written();
+    digest = (digest ^ sim.transport->digest()) * 1099511628211ull;
+  }
+
+  clients.clear();
+  server.reset();
+  set_clock(nullptr);
+  std::cout.rdbuf(console);
+
+  std::cout << "clients  : " << clientCount << std::endl
+            << "channels : " << channelCount << std::endl
+            << "messages : " << messageCount << " (" << served << " served)"
+            << std::endl
+            << "virtual  : " << virtualNow << " ms" << std::endl
+            << "elapsed  : " << seconds << " s" << std::endl
+            << "rate     : " << static_cast<uint64_t>(messageCount / seconds)
+            << " messages/s, "
+            << static_cast<uint64_t>(bytes / seconds / (1 << 20))
+            << " MiB/s delivered" << std::endl
+            << "bytes    : " << bytes << std::endl
+            << "digest   : " << std::hex << digest << std::dec << std::endl;
+  return 0;
+}